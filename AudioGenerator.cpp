@@ -1,74 +1,1093 @@
-#include <iostream>
-#include <vector>
-#include <cmath>
-#include <sndfile.h>
-#include <fstream>
-#include <stdexcept>
-#include <string>
-
-class AudioGenerator {
-public:
-    AudioGenerator(double duration, int sampleRate, double frequency)
-        : duration(duration), sampleRate(sampleRate), frequency(frequency) {
-        generateSignal();
-    }
-
-    void saveToWav(const std::string &filename) {
-        SF_INFO sfinfo;
-        sfinfo.frames = static_cast<sf_count_t>(signal.size());
-        sfinfo.samplerate = sampleRate;
-        sfinfo.channels = 1; // 单声道
-        sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
-
-        SNDFILE *outfile = sf_open(filename.c_str(), SFM_WRITE, &sfinfo, nullptr);
-        if (!outfile) {
-            throw std::runtime_error("Error opening output file.");
-        }
-        
-        sf_writef_int(outfile, signal.data(), static_cast<sf_count_t>(signal.size()));
-        sf_close(outfile);
-        log("Audio saved to " + filename);
-    }
-
-private:
-    double duration;
-    int sampleRate;
-    double frequency;
-    std::vector<int16_t> signal;
-
-    void generateSignal() {
-        int totalSamples = static_cast<int>(sampleRate * duration);
-        signal.resize(totalSamples);
-
-        for (int i = 0; i < totalSamples; ++i) {
-            double t = static_cast<double>(i) / sampleRate;
-            signal[i] = static_cast<int16_t>(32767 * sin(2 * M_PI * frequency * t));
-        }
-
-        log("Signal generated with frequency " + std::to_string(frequency) + " Hz.");
-    }
-
-    void log(const std::string &message) {
-        std::ofstream logFile("audio_generation.log", std::ios_base::app);
-        if (logFile) {
-            logFile << message << std::endl;
-        }
-    }
-};
-
-int main() {
-    try {
-        double duration = 5.0;  // 音频时长（秒）
-        int sampleRate = 44100; // 采样率
-        double frequency = 440;  // 正弦波频率（Hz）
-
-        AudioGenerator audioGen(duration, sampleRate, frequency);
-        audioGen.saveToWav("output.wav");
-        
-    } catch (const std::exception &e) {
-        std::cerr << "Exception: " << e.what() << std::endl;
-        return EXIT_FAILURE;
-    }
-
-    return EXIT_SUCCESS;
-}
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <sndfile.h>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <future>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <type_traits>
+#include "Logger.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KICKAI_X86 1
+#endif
+
+// Phase-accumulator sine oscillator. Phase is tracked in cycles and each
+// sample evaluates sin(2*pi*x) with a degree-15 odd Taylor polynomial after
+// folding x into [-1/4, 1/4]. The polynomial is within 7e-12 of libm sin();
+// output is rounded to float, so the stated bound against libm is 1e-7.
+namespace oscillator {
+
+constexpr double kMaxError = 1e-7;
+
+// Writes sin(2*pi*(phase + (first + i)*increment)) for i in [0, n). phase is
+// the phase at the chunk anchor; callers keep it and increment in [0, 1) and
+// first + n <= kChunkFrames. Each sample depends only on its distance from
+// the anchor, never on where a call starts, so output is the same however a
+// render is split into blocks.
+using Kernel = void (*)(double phase, double increment, size_t first, float *out, size_t n);
+
+constexpr size_t kChunkFrames = 4096;
+
+constexpr double kTwoPi = 6.283185307179586476925286766559;
+constexpr double kS3 = -1.0 / 6;
+constexpr double kS5 = 1.0 / 120;
+constexpr double kS7 = -1.0 / 5040;
+constexpr double kS9 = 1.0 / 362880;
+constexpr double kS11 = -1.0 / 39916800;
+constexpr double kS13 = 1.0 / 6227020800;
+constexpr double kS15 = -1.0 / 1307674368000;
+
+inline double sinCycles(double x) {
+    double r = x - std::floor(x + 0.5);
+    double a = std::fabs(r);
+    a = std::min(a, 0.5 - a);
+    double y = kTwoPi * a;
+    double y2 = y * y;
+    double p = kS15;
+    p = p * y2 + kS13;
+    p = p * y2 + kS11;
+    p = p * y2 + kS9;
+    p = p * y2 + kS7;
+    p = p * y2 + kS5;
+    p = p * y2 + kS3;
+    double v = y + y * y2 * p;
+    return r < 0 ? -v : v;
+}
+
+inline void scalarKernel(double phase, double increment, size_t first, float *out, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = static_cast<float>(sinCycles(phase + static_cast<double>(first + i) * increment));
+    }
+}
+
+#ifdef KICKAI_X86
+// SSE2 is part of the x86-64 baseline; floor is done by truncation, which is
+// exact here because x + 0.5 is non-negative and below 2^31. Tails are
+// computed as full vectors so no sample falls back to the scalar rounding.
+__attribute__((target("sse2")))
+inline void sse2Kernel(double phase, double increment, size_t first, float *out, size_t n) {
+    const __m128d half = _mm_set1_pd(0.5);
+    const __m128d signMask = _mm_set1_pd(-0.0);
+    const __m128d twoPi = _mm_set1_pd(kTwoPi);
+    const __m128d lanes = _mm_set_pd(1, 0);
+    const __m128d inc = _mm_set1_pd(increment);
+    const __m128d base = _mm_set1_pd(phase);
+    for (size_t i = 0; i < n; i += 2) {
+        __m128d index = _mm_add_pd(lanes, _mm_set1_pd(static_cast<double>(first + i)));
+        __m128d x = _mm_add_pd(_mm_mul_pd(index, inc), base);
+        __m128d fl = _mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_add_pd(x, half)));
+        __m128d r = _mm_sub_pd(x, fl);
+        __m128d sign = _mm_and_pd(r, signMask);
+        __m128d a = _mm_andnot_pd(signMask, r);
+        a = _mm_min_pd(a, _mm_sub_pd(half, a));
+        __m128d y = _mm_mul_pd(twoPi, a);
+        __m128d y2 = _mm_mul_pd(y, y);
+        __m128d p = _mm_set1_pd(kS15);
+        p = _mm_add_pd(_mm_mul_pd(p, y2), _mm_set1_pd(kS13));
+        p = _mm_add_pd(_mm_mul_pd(p, y2), _mm_set1_pd(kS11));
+        p = _mm_add_pd(_mm_mul_pd(p, y2), _mm_set1_pd(kS9));
+        p = _mm_add_pd(_mm_mul_pd(p, y2), _mm_set1_pd(kS7));
+        p = _mm_add_pd(_mm_mul_pd(p, y2), _mm_set1_pd(kS5));
+        p = _mm_add_pd(_mm_mul_pd(p, y2), _mm_set1_pd(kS3));
+        __m128d v = _mm_add_pd(y, _mm_mul_pd(_mm_mul_pd(y, y2), p));
+        v = _mm_xor_pd(v, sign);
+        if (i + 2 <= n) {
+            _mm_storel_pi(reinterpret_cast<__m64 *>(out + i), _mm_cvtpd_ps(v));
+        } else {
+            _mm_store_ss(out + i, _mm_cvtpd_ps(v));
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+inline void avx2Kernel(double phase, double increment, size_t first, float *out, size_t n) {
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d signMask = _mm256_set1_pd(-0.0);
+    const __m256d twoPi = _mm256_set1_pd(kTwoPi);
+    const __m256d lanes = _mm256_set_pd(3, 2, 1, 0);
+    const __m256d inc = _mm256_set1_pd(increment);
+    const __m256d base = _mm256_set1_pd(phase);
+    for (size_t i = 0; i < n; i += 4) {
+        // Recomputed from the lane index rather than accumulated, so there is
+        // no drift across the chunk.
+        __m256d index = _mm256_add_pd(lanes, _mm256_set1_pd(static_cast<double>(first + i)));
+        __m256d x = _mm256_fmadd_pd(index, inc, base);
+        __m256d r = _mm256_sub_pd(x, _mm256_floor_pd(_mm256_add_pd(x, half)));
+        __m256d sign = _mm256_and_pd(r, signMask);
+        __m256d a = _mm256_andnot_pd(signMask, r);
+        a = _mm256_min_pd(a, _mm256_sub_pd(half, a));
+        __m256d y = _mm256_mul_pd(twoPi, a);
+        __m256d y2 = _mm256_mul_pd(y, y);
+        __m256d p = _mm256_set1_pd(kS15);
+        p = _mm256_fmadd_pd(p, y2, _mm256_set1_pd(kS13));
+        p = _mm256_fmadd_pd(p, y2, _mm256_set1_pd(kS11));
+        p = _mm256_fmadd_pd(p, y2, _mm256_set1_pd(kS9));
+        p = _mm256_fmadd_pd(p, y2, _mm256_set1_pd(kS7));
+        p = _mm256_fmadd_pd(p, y2, _mm256_set1_pd(kS5));
+        p = _mm256_fmadd_pd(p, y2, _mm256_set1_pd(kS3));
+        __m256d v = _mm256_fmadd_pd(_mm256_mul_pd(y, y2), p, y);
+        v = _mm256_xor_pd(v, sign);
+        if (i + 4 <= n) {
+            _mm_storeu_ps(out + i, _mm256_cvtpd_ps(v));
+        } else {
+            alignas(16) float tail[4];
+            _mm_store_ps(tail, _mm256_cvtpd_ps(v));
+            std::memcpy(out + i, tail, (n - i) * sizeof(float));
+        }
+    }
+}
+#endif
+
+struct Path {
+    const char *name;
+    Kernel kernel;
+};
+
+// Every path usable on this CPU, fastest first.
+inline std::vector<Path> availablePaths() {
+    std::vector<Path> paths;
+#ifdef KICKAI_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        paths.push_back({"avx2", avx2Kernel});
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        paths.push_back({"sse2", sse2Kernel});
+    }
+#endif
+    paths.push_back({"scalar", scalarKernel});
+    return paths;
+}
+
+inline const Path &selected() {
+    static const Path path = availablePaths().front();
+    return path;
+}
+
+// Fills out with n samples of a unit sine at increment cycles per sample,
+// starting at absolute sample index start. Chunks are anchored at multiples
+// of kChunkFrames in absolute sample time.
+inline void render(double increment, int64_t start, float *out, size_t n, Kernel kernel = selected().kernel) {
+    increment -= std::floor(increment);
+    const int64_t end = start + static_cast<int64_t>(n);
+    for (int64_t index = start; index < end;) {
+        int64_t anchor = index - index % static_cast<int64_t>(kChunkFrames);
+        int64_t stop = std::min(anchor + static_cast<int64_t>(kChunkFrames), end);
+        double phase = std::fmod(static_cast<double>(anchor) * increment, 1.0);
+        kernel(phase, increment, static_cast<size_t>(index - anchor), out + (index - start),
+               static_cast<size_t>(stop - index));
+        index = stop;
+    }
+}
+
+} // namespace oscillator
+
+// Fixed set of worker threads that render slices of a block. The calling
+// thread takes part in every parallelFor, so a pool of size 1 has no workers.
+class RenderPool {
+public:
+    explicit RenderPool(unsigned threads) {
+        for (unsigned i = 1; i < std::max(1u, threads); ++i) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~RenderPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    RenderPool(const RenderPool &) = delete;
+    RenderPool &operator=(const RenderPool &) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+    // Runs fn(0) .. fn(tasks - 1) and returns once all of them have finished.
+    // Concurrent callers are serialized.
+    void parallelFor(size_t tasks, const std::function<void(size_t)> &fn) {
+        if (workers.empty() || tasks <= 1) {
+            for (size_t i = 0; i < tasks; ++i) {
+                fn(i);
+            }
+            return;
+        }
+
+        std::lock_guard<std::mutex> call(callMutex);
+        Batch batch{&fn, tasks};
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = &batch;
+            ++generation;
+        }
+        wake.notify_all();
+        runTasks(batch);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        current = nullptr;
+        done.wait(lock, [&] { return batch.finished == batch.count && batch.attached == 0; });
+    }
+
+private:
+    struct Batch {
+        const std::function<void(size_t)> *fn;
+        size_t count;
+        std::atomic<size_t> next{0};
+        size_t finished = 0;  // guarded by mutex
+        unsigned attached = 0; // workers still holding a pointer to this batch
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex callMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    Batch *current = nullptr;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void runTasks(Batch &batch) {
+        size_t ran = 0;
+        for (size_t i; (i = batch.next.fetch_add(1)) < batch.count; ++ran) {
+            (*batch.fn)(i);
+        }
+        if (ran > 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            batch.finished += ran;
+        }
+    }
+
+    void workerLoop() {
+        uint64_t seen = 0;
+        for (;;) {
+            Batch *batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || (current && generation != seen); });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+                batch = current;
+                ++batch->attached;
+            }
+            runTasks(*batch);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --batch->attached;
+            }
+            done.notify_all();
+        }
+    }
+};
+
+// One sine partial. pan places the voice between the first (0) and last (1)
+// channel with an equal-power law.
+struct Voice {
+    double frequency;
+    double amplitude = 1.0;
+    double pan = 0.5;
+};
+
+enum class SampleFormat { Pcm16, Pcm24, Float32 };
+
+inline SampleFormat parseSampleFormat(const std::string &name) {
+    if (name == "pcm16") return SampleFormat::Pcm16;
+    if (name == "pcm24") return SampleFormat::Pcm24;
+    if (name == "float") return SampleFormat::Float32;
+    throw std::invalid_argument("Unknown sample format: " + name);
+}
+
+inline int bytesPerSample(SampleFormat format) {
+    return format == SampleFormat::Pcm16 ? 2 : format == SampleFormat::Pcm24 ? 3 : 4;
+}
+
+// In-memory sample type for each output format. Every type maps to the
+// libsndfile call that takes it as-is, so no conversion buffer sits between
+// the mixer and sf_writef_*. PCM_24 is held left-aligned in an int32_t, the
+// layout sf_writef_int expects.
+template <typename Sample> struct SampleTraits;
+
+template <> struct SampleTraits<int16_t> {
+    static constexpr int subtype = SF_FORMAT_PCM_16;
+    static sf_count_t write(SNDFILE *f, const int16_t *p, sf_count_t n) { return sf_writef_short(f, p, n); }
+    static sf_count_t read(SNDFILE *f, int16_t *p, sf_count_t n) { return sf_readf_short(f, p, n); }
+};
+
+template <> struct SampleTraits<int32_t> {
+    static constexpr int subtype = SF_FORMAT_PCM_24;
+    static sf_count_t write(SNDFILE *f, const int32_t *p, sf_count_t n) { return sf_writef_int(f, p, n); }
+    static sf_count_t read(SNDFILE *f, int32_t *p, sf_count_t n) { return sf_readf_int(f, p, n); }
+};
+
+template <> struct SampleTraits<float> {
+    static constexpr int subtype = SF_FORMAT_FLOAT;
+    static sf_count_t write(SNDFILE *f, const float *p, sf_count_t n) { return sf_writef_float(f, p, n); }
+    static sf_count_t read(SNDFILE *f, float *p, sf_count_t n) { return sf_readf_float(f, p, n); }
+};
+
+// Float mix to integer PCM with round-to-nearest and optional TPDF dither
+// (difference of two uniform values, +/-1 LSB). The noise for a sample is a
+// hash of its absolute interleaved index (frame * channels + channel), so
+// output does not depend on block size, slicing or thread count, and the
+// scalar and AVX2 paths give bit-identical results.
+namespace quantize {
+
+// Index of the next sample to be converted; advanced by each conversion.
+struct Dither {
+    uint64_t next;
+};
+
+// Both uniforms come from one 32-bit hash of the index halves, 16 bits each.
+inline uint32_t noiseHash(uint32_t lo, uint32_t hi) {
+    uint32_t h = lo * 0x9E3779B1u ^ (hi + 0x632BE5ABu) * 0x85EBCA77u;
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return h;
+}
+
+// scale is the largest positive code; shift left-aligns it in the output word.
+template <typename Int>
+inline void scalarToInt(const float *in, Int *out, size_t n, float scale, int shift, Dither *dither) {
+    for (size_t i = 0; i < n; ++i) {
+        float x = std::clamp(in[i], -1.0f, 1.0f) * scale;
+        if (dither) {
+            uint64_t index = dither->next + i;
+            uint32_t h = noiseHash(static_cast<uint32_t>(index), static_cast<uint32_t>(index >> 32));
+            x += static_cast<float>(h & 0xFFFF) * (1.0f / 65536) - static_cast<float>(h >> 16) * (1.0f / 65536);
+        }
+        long q = std::clamp(std::lrint(x), -static_cast<long>(scale) - 1, static_cast<long>(scale));
+        out[i] = static_cast<Int>(static_cast<uint32_t>(q) << shift);
+    }
+    if (dither) {
+        dither->next += n;
+    }
+}
+
+#ifdef KICKAI_X86
+// noiseHash of eight consecutive indices starting at first.
+__attribute__((target("avx2")))
+inline __m256i avx2NoiseHash(uint64_t first) {
+    const __m256i bias = _mm256_set1_epi32(static_cast<int>(0x80000000u));
+    __m256i base = _mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(first)));
+    __m256i lo = _mm256_add_epi32(base, _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    // Lanes whose low half wrapped carry into the high half (unsigned lo < base).
+    __m256i carry = _mm256_cmpgt_epi32(_mm256_xor_si256(base, bias), _mm256_xor_si256(lo, bias));
+    __m256i hi = _mm256_sub_epi32(_mm256_set1_epi32(static_cast<int>(static_cast<uint32_t>(first >> 32))), carry);
+    __m256i h = _mm256_xor_si256(_mm256_mullo_epi32(lo, _mm256_set1_epi32(static_cast<int>(0x9E3779B1u))),
+                                 _mm256_mullo_epi32(_mm256_add_epi32(hi, _mm256_set1_epi32(0x632BE5AB)),
+                                                    _mm256_set1_epi32(static_cast<int>(0x85EBCA77u))));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32(0x7FEB352D));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32(static_cast<int>(0x846CA68Bu)));
+    return _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+}
+
+__attribute__((target("avx2")))
+inline __m256i avx2Quantize(__m256 x, float scale, const Dither *dither, uint64_t index) {
+    x = _mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f)),
+                      _mm256_set1_ps(scale));
+    if (dither) {
+        const __m256 unit = _mm256_set1_ps(1.0f / 65536);
+        __m256i h = avx2NoiseHash(index);
+        __m256 u1 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(h, _mm256_set1_epi32(0xFFFF))), unit);
+        __m256 u2 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(h, 16)), unit);
+        x = _mm256_add_ps(x, _mm256_sub_ps(u1, u2));
+    }
+    __m256i q = _mm256_cvtps_epi32(x);
+    q = _mm256_min_epi32(q, _mm256_set1_epi32(static_cast<int>(scale)));
+    return _mm256_max_epi32(q, _mm256_set1_epi32(-static_cast<int>(scale) - 1));
+}
+
+__attribute__((target("avx2")))
+inline void avx2ToInt16(const float *in, int16_t *out, size_t n, Dither *dither) {
+    uint64_t first = dither ? dither->next : 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i lo = avx2Quantize(_mm256_loadu_ps(in + i), 32767.0f, dither, first + i);
+        __m256i hi = avx2Quantize(_mm256_loadu_ps(in + i + 8), 32767.0f, dither, first + i + 8);
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), packed);
+    }
+    if (dither) {
+        dither->next += i;
+    }
+    scalarToInt(in + i, out + i, n - i, 32767.0f, 0, dither);
+}
+
+__attribute__((target("avx2")))
+inline void avx2ToInt24(const float *in, int32_t *out, size_t n, Dither *dither) {
+    uint64_t first = dither ? dither->next : 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i q = avx2Quantize(_mm256_loadu_ps(in + i), 8388607.0f, dither, first + i);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_slli_epi32(q, 8));
+    }
+    if (dither) {
+        dither->next += i;
+    }
+    scalarToInt(in + i, out + i, n - i, 8388607.0f, 8, dither);
+}
+#endif
+
+inline bool useAvx2() {
+#ifdef KICKAI_X86
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+inline void convert(const float *in, int16_t *out, size_t n, Dither *dither) {
+#ifdef KICKAI_X86
+    if (useAvx2()) {
+        avx2ToInt16(in, out, n, dither);
+        return;
+    }
+#endif
+    scalarToInt(in, out, n, 32767.0f, 0, dither);
+}
+
+inline void convert(const float *in, int32_t *out, size_t n, Dither *dither) {
+#ifdef KICKAI_X86
+    if (useAvx2()) {
+        avx2ToInt24(in, out, n, dither);
+        return;
+    }
+#endif
+    scalarToInt(in, out, n, 8388607.0f, 8, dither);
+}
+
+} // namespace quantize
+
+// The double buffer used by one streaming render, for whichever sample type
+// the output format needs, plus the float mix for integer output with more
+// channels than a slice's stack mix holds. Vectors keep their capacity, so a
+// set handed back to a BufferPool is reused without reallocating.
+struct BlockBuffers {
+    std::vector<int16_t> pcm16[2];
+    std::vector<int32_t> pcm24[2];
+    std::vector<float> float32[2];
+    std::vector<float> wideMix;
+
+    template <typename Sample> std::vector<Sample> *get();
+};
+
+template <> inline std::vector<int16_t> *BlockBuffers::get<int16_t>() { return pcm16; }
+template <> inline std::vector<int32_t> *BlockBuffers::get<int32_t>() { return pcm24; }
+template <> inline std::vector<float> *BlockBuffers::get<float>() { return float32; }
+
+// Fixed number of BlockBuffers shared by concurrent renders; acquire() blocks
+// while all of them are in use, which bounds total buffer memory.
+class BufferPool {
+public:
+    explicit BufferPool(size_t capacity) {
+        for (size_t i = 0; i < capacity; ++i) {
+            idle.push_back(std::make_unique<BlockBuffers>());
+        }
+    }
+
+    std::unique_ptr<BlockBuffers> acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+        available.wait(lock, [this] { return !idle.empty(); });
+        auto buffers = std::move(idle.back());
+        idle.pop_back();
+        return buffers;
+    }
+
+    void release(std::unique_ptr<BlockBuffers> buffers) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.push_back(std::move(buffers));
+        }
+        available.notify_one();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable available;
+    std::vector<std::unique_ptr<BlockBuffers>> idle;
+};
+
+class AudioGenerator {
+public:
+    static constexpr sf_count_t kDefaultBlockFrames = 8192;
+    // Frames per parallel task; keeps the interleaved float mix of an 8-channel
+    // slice plus one voice buffer inside L1.
+    static constexpr sf_count_t kSliceFrames = 512;
+
+    AudioGenerator(double duration, int sampleRate, double frequency)
+        : AudioGenerator(duration, sampleRate, {Voice{frequency}}, 1) {}
+
+    AudioGenerator(double duration, int sampleRate, std::vector<Voice> voices, int channels,
+                   std::shared_ptr<RenderPool> pool = nullptr)
+        : duration(duration), sampleRate(sampleRate), channels(channels), voices(std::move(voices)),
+          pool(std::move(pool)), totalFrames(static_cast<sf_count_t>(sampleRate * duration)) {
+        if (channels < 1) {
+            throw std::invalid_argument("Channel count must be positive.");
+        }
+        for (const auto &voice : this->voices) {
+            gains.push_back(panGains(voice));
+        }
+    }
+
+    sf_count_t frameCount() const { return totalFrames; }
+    int channelCount() const { return channels; }
+
+    // Integer formats get TPDF dither when enabled; float output never does.
+    void setDither(bool enabled) { dither = enabled; }
+
+    // Renders frames [offset, offset + frames) of the mix into out, interleaved
+    // by channel. Slices of kSliceFrames are spread over the render pool.
+    // Integer output with more than 8 channels mixes into wideMix, one region
+    // per slice; pass a reused vector to keep that off the heap.
+    template <typename Sample>
+    void renderBlock(sf_count_t offset, Sample *out, sf_count_t frames, std::vector<float> *wideMix = nullptr) const {
+        std::vector<float> localMix;
+        float *wide = nullptr;
+        if (!std::is_same_v<Sample, float> && channels > 8) {
+            if (!wideMix) {
+                wideMix = &localMix;
+            }
+            wideMix->resize(static_cast<size_t>(frames * channels));
+            wide = wideMix->data();
+        }
+        size_t slices = static_cast<size_t>((frames + kSliceFrames - 1) / kSliceFrames);
+        auto renderSlice = [&](size_t slice) {
+            sf_count_t start = static_cast<sf_count_t>(slice) * kSliceFrames;
+            sf_count_t count = std::min(kSliceFrames, frames - start);
+            mixSlice(offset + start, out + start * channels, static_cast<size_t>(count),
+                     wide ? wide + start * channels : nullptr);
+        };
+        if (pool) {
+            pool->parallelFor(slices, renderSlice);
+        } else {
+            for (size_t slice = 0; slice < slices; ++slice) {
+                renderSlice(slice);
+            }
+        }
+    }
+
+    // Whole-clip path: the entire signal is rendered as a single block.
+    void saveToWav(const std::string &filename) {
+        streamToWav(filename, totalFrames);
+    }
+
+    // Renders blockFrames at a time; block n is written on a background task
+    // while block n + 1 is rendered, so memory stays at two blocks. 0 picks
+    // kDefaultBlockFrames per render thread. Pass buffers to reuse block
+    // storage across renders.
+    void streamToWav(const std::string &filename, sf_count_t blockFrames = 0,
+                     SampleFormat format = SampleFormat::Pcm16, BlockBuffers *buffers = nullptr) {
+        switch (format) {
+        case SampleFormat::Pcm24:
+            streamAs<int32_t>(filename, blockFrames, buffers);
+            break;
+        case SampleFormat::Float32:
+            streamAs<float>(filename, blockFrames, buffers);
+            break;
+        default:
+            streamAs<int16_t>(filename, blockFrames, buffers);
+            break;
+        }
+    }
+
+private:
+    // A voice feeds at most two adjacent channels.
+    struct VoiceGains {
+        int channel;
+        float first;
+        float second;
+    };
+
+    double duration;
+    int sampleRate;
+    int channels;
+    std::vector<Voice> voices;
+    std::vector<VoiceGains> gains;
+    std::shared_ptr<RenderPool> pool;
+    sf_count_t totalFrames;
+    bool dither = false;
+
+    template <typename Sample>
+    void streamAs(const std::string &filename, sf_count_t blockFrames, BlockBuffers *buffers) {
+        if (blockFrames < 0) {
+            throw std::invalid_argument("Block size must not be negative.");
+        }
+        if (blockFrames == 0) {
+            blockFrames = kDefaultBlockFrames * (pool ? pool->size() : 1);
+        }
+        blockFrames = std::max<sf_count_t>(1, std::min(blockFrames, totalFrames));
+
+        SF_INFO sfinfo = {};
+        sfinfo.samplerate = sampleRate;
+        sfinfo.channels = channels;
+        sfinfo.format = SF_FORMAT_WAV | SampleTraits<Sample>::subtype;
+
+        SNDFILE *outfile = sf_open(filename.c_str(), SFM_WRITE, &sfinfo);
+        if (!outfile) {
+            throw std::runtime_error("Error opening output file.");
+        }
+
+        BlockBuffers localBuffers;
+        if (!buffers) {
+            buffers = &localBuffers;
+        }
+        std::future<sf_count_t> pending;
+        sf_count_t pendingFrames = 0;
+        int current = 0;
+        try {
+            for (sf_count_t offset = 0; offset < totalFrames; offset += blockFrames) {
+                sf_count_t frames = std::min(blockFrames, totalFrames - offset);
+                std::vector<Sample> &block = buffers->get<Sample>()[current];
+                block.resize(static_cast<size_t>(frames * channels));
+                renderBlock(offset, block.data(), frames, &buffers->wideMix);
+
+                if (pending.valid()) {
+                    checkWrite(outfile, pending.get(), pendingFrames);
+                }
+                pending = std::async(std::launch::async, [outfile, &block, frames] {
+                    return SampleTraits<Sample>::write(outfile, block.data(), frames);
+                });
+                pendingFrames = frames;
+                current ^= 1;
+            }
+            if (pending.valid()) {
+                checkWrite(outfile, pending.get(), pendingFrames);
+            }
+        } catch (...) {
+            if (pending.valid()) {
+                pending.wait();
+            }
+            sf_close(outfile);
+            throw;
+        }
+        sf_close(outfile);
+
+        if (voices.size() == 1) {
+            log("Signal generated with frequency " + std::to_string(voices[0].frequency) + " Hz.");
+        } else {
+            log("Signal generated with " + std::to_string(voices.size()) + " voices on " +
+                std::to_string(channels) + " channels.");
+        }
+        log("Audio saved to " + filename);
+    }
+
+    VoiceGains panGains(const Voice &voice) const {
+        if (channels == 1) {
+            return {0, static_cast<float>(voice.amplitude), 0.0f};
+        }
+        double position = std::clamp(voice.pan, 0.0, 1.0) * (channels - 1);
+        int channel = std::min(static_cast<int>(position), channels - 2);
+        double frac = position - channel;
+        return {channel, static_cast<float>(voice.amplitude * std::cos(frac * M_PI / 2)),
+                static_cast<float>(voice.amplitude * std::sin(frac * M_PI / 2))};
+    }
+
+    // Accumulates every voice into an interleaved float mix, then quantizes the
+    // slice in one pass. Float output is mixed in place; past 8 channels the
+    // mix goes to wideMix, this slice's region of the block's wide buffer.
+    template <typename Sample>
+    void mixSlice(sf_count_t offset, Sample *out, size_t frames, float *wideMix) const {
+        alignas(64) float mix[kSliceFrames * 8];
+        float *acc;
+        if constexpr (std::is_same_v<Sample, float>) {
+            acc = out;
+        } else if (channels > 8) {
+            acc = wideMix;
+        } else {
+            acc = mix;
+        }
+        accumulate(offset, acc, frames);
+
+        if constexpr (std::is_same_v<Sample, float>) {
+            for (size_t i = 0; i < frames * channels; ++i) {
+                acc[i] = std::clamp(acc[i], -1.0f, 1.0f);
+            }
+        } else {
+            quantize::Dither noise{static_cast<uint64_t>(offset) * static_cast<uint64_t>(channels)};
+            quantize::convert(acc, out, frames * channels, dither ? &noise : nullptr);
+        }
+    }
+
+    void accumulate(sf_count_t offset, float *acc, size_t frames) const {
+        alignas(64) float wave[kSliceFrames];
+        std::fill(acc, acc + frames * channels, 0.0f);
+
+        for (size_t v = 0; v < voices.size(); ++v) {
+            oscillator::render(voices[v].frequency / sampleRate, offset, wave, frames);
+            const VoiceGains &g = gains[v];
+            float *dst = acc + g.channel;
+            if (channels == 1) {
+                for (size_t i = 0; i < frames; ++i) {
+                    dst[i] += g.first * wave[i];
+                }
+            } else {
+                for (size_t i = 0; i < frames; ++i) {
+                    dst[i * channels] += g.first * wave[i];
+                    dst[i * channels + 1] += g.second * wave[i];
+                }
+            }
+        }
+    }
+
+    static void checkWrite(SNDFILE *outfile, sf_count_t written, sf_count_t expected) {
+        if (written != expected) {
+            throw std::runtime_error(std::string("Error writing audio: ") + sf_strerror(outfile));
+        }
+    }
+
+    // One asynchronous logger per process, shared by concurrent renders.
+    static void log(const std::string &message) {
+        static kickai::Logger logger("audio_generation.log");
+        logger.info(message);
+    }
+};
+
+// One manifest line: duration,sample_rate,frequency,format,output_path
+struct ToneJob {
+    double duration;
+    int sampleRate;
+    double frequency;
+    SampleFormat format;
+    std::string output;
+};
+
+// Renders every job of a CSV manifest in one process. Jobs are spread over
+// worker threads; each render borrows its block buffers from a shared pool,
+// so memory stays bounded no matter how many jobs or how long they are.
+class BatchRunner {
+public:
+    BatchRunner(unsigned workers, bool dither)
+        : workers(std::max(1u, workers)), dither(dither), buffers(this->workers) {}
+
+    static std::vector<ToneJob> readManifest(const std::string &path) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            throw std::runtime_error("Could not open manifest: " + path);
+        }
+
+        std::vector<ToneJob> jobs;
+        std::string line;
+        for (int lineNumber = 1; std::getline(file, line); ++lineNumber) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back(); // CRLF manifest
+            }
+            if (line.empty() || line[0] == '#' || line.rfind("duration", 0) == 0) {
+                continue;
+            }
+            std::istringstream iss(line);
+            std::string duration, sampleRate, frequency, format, output;
+            std::getline(iss, duration, ',');
+            std::getline(iss, sampleRate, ',');
+            std::getline(iss, frequency, ',');
+            std::getline(iss, format, ',');
+            std::getline(iss, output);
+            if (output.empty()) {
+                throw std::runtime_error("Malformed manifest line " + std::to_string(lineNumber) + ": " + line);
+            }
+            try {
+                jobs.push_back({std::stod(duration), std::stoi(sampleRate), std::stod(frequency),
+                                parseSampleFormat(format), output});
+            } catch (const std::exception &e) {
+                throw std::runtime_error("Malformed manifest line " + std::to_string(lineNumber) + ": " + e.what());
+            }
+        }
+        return jobs;
+    }
+
+    // Returns the number of failed jobs.
+    size_t run(const std::vector<ToneJob> &jobs) {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> failed{0};
+        std::atomic<uint64_t> frames{0};
+        std::atomic<uint64_t> bytes{0};
+
+        auto start = std::chrono::steady_clock::now();
+        auto work = [&] {
+            for (size_t i; (i = next.fetch_add(1)) < jobs.size();) {
+                const ToneJob &job = jobs[i];
+                auto blockBuffers = buffers.acquire();
+                try {
+                    AudioGenerator gen(job.duration, job.sampleRate, job.frequency);
+                    gen.setDither(dither);
+                    gen.streamToWav(job.output, AudioGenerator::kDefaultBlockFrames, job.format, blockBuffers.get());
+                    frames += static_cast<uint64_t>(gen.frameCount());
+                    bytes += static_cast<uint64_t>(gen.frameCount()) * bytesPerSample(job.format);
+                } catch (const std::exception &e) {
+                    ++failed;
+                    std::cerr << "Job " << i + 1 << " (" << job.output << ") failed: " << e.what() << std::endl;
+                }
+                buffers.release(std::move(blockBuffers));
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < workers; ++i) {
+            threads.emplace_back(work);
+        }
+        work();
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double audioSeconds = 0;
+        for (const auto &job : jobs) {
+            audioSeconds += job.duration;
+        }
+        std::cout << "Rendered " << jobs.size() - failed << "/" << jobs.size() << " jobs with " << workers
+                  << " workers in " << seconds << " s: " << jobs.size() / seconds << " jobs/s, "
+                  << frames / seconds / 1e6 << " Mframes/s, " << bytes / seconds / 1e6 << " MB/s, "
+                  << audioSeconds / seconds << "x realtime" << std::endl;
+        return failed;
+    }
+
+private:
+    unsigned workers;
+    bool dither;
+    BufferPool buffers;
+};
+
+// Reports samples/sec and the worst deviation from libm for every
+// oscillator path available on this machine.
+int benchOscillator() {
+    const double increment = 440.0 / 44100;
+    const size_t samples = size_t(1) << 24;
+    std::vector<float> out(samples);
+
+    for (const auto &path : oscillator::availablePaths()) {
+        oscillator::render(increment, 0, out.data(), samples, path.kernel); // warm-up
+        auto start = std::chrono::steady_clock::now();
+        const int rounds = 8;
+        for (int r = 0; r < rounds; ++r) {
+            oscillator::render(increment, static_cast<int64_t>(r) * samples, out.data(), samples, path.kernel);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double maxError = 0;
+        for (size_t i = 0; i < samples; ++i) {
+            double t = static_cast<double>((rounds - 1) * samples + i) / 44100;
+            maxError = std::max(maxError, std::fabs(out[i] - sin(2 * M_PI * 440.0 * t)));
+        }
+        std::cout << path.name << ": " << (rounds * samples / seconds / 1e6) << " Msamples/s, max error "
+                  << maxError << (maxError <= oscillator::kMaxError ? " (ok)" : " (EXCEEDS BOUND)") << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Renders a 32-partial, 8-channel bank with 1..N render threads and reports
+// frames/sec so the scaling of the mixer can be checked.
+int benchMixer() {
+    const int channels = 8;
+    const sf_count_t frames = 1 << 20;
+    std::vector<Voice> voices;
+    for (int i = 0; i < 32; ++i) {
+        voices.push_back({110.0 * (i + 1), 1.0 / 32, i / 31.0});
+    }
+    std::vector<int16_t> out(static_cast<size_t>(frames * channels));
+
+    unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> threadCounts;
+    for (unsigned threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    double baseline = 0;
+    for (unsigned threads : threadCounts) {
+        AudioGenerator gen(0, 48000, voices, channels, std::make_shared<RenderPool>(threads));
+        gen.renderBlock(0, out.data(), frames / 8); // warm-up
+        auto start = std::chrono::steady_clock::now();
+        for (sf_count_t offset = 0; offset < frames; offset += 65536) {
+            gen.renderBlock(offset, out.data() + offset * channels, 65536);
+        }
+        double rate = frames / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (threads == 1) {
+            baseline = rate;
+        }
+        std::cout << threads << " threads: " << rate / 1e6 << " Mframes/s, speedup " << rate / baseline << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Writes a stereo two-voice clip in every format, reads it back with the
+// matching sf_readf_* call and checks it against the in-memory render.
+template <typename Sample>
+bool roundTrip(SampleFormat format, const char *name) {
+    const sf_count_t frames = 48000;
+    AudioGenerator gen(1.0, 48000, {{440.0, 0.5, 0.0}, {1250.0, 0.5, 1.0}}, 2);
+    std::vector<Sample> expected(static_cast<size_t>(frames * 2));
+    gen.renderBlock(0, expected.data(), frames);
+
+    std::string path = std::string("roundtrip_") + name + ".wav";
+    gen.streamToWav(path, 1000, format);
+
+    SF_INFO sfinfo = {};
+    SNDFILE *infile = sf_open(path.c_str(), SFM_READ, &sfinfo);
+    if (!infile) {
+        std::cout << name << ": could not reopen " << path << std::endl;
+        return false;
+    }
+    std::vector<Sample> actual(expected.size());
+    sf_count_t read = SampleTraits<Sample>::read(infile, actual.data(), frames);
+    sf_close(infile);
+    std::remove(path.c_str());
+
+    bool ok = read == frames && sfinfo.channels == 2 && actual == expected;
+    std::cout << name << ": " << (ok ? "ok" : "MISMATCH") << std::endl;
+    return ok;
+}
+
+// Dithered PCM_16 must not depend on how a render is cut up: the same clip
+// streamed with two block sizes over a 3-thread pool has to read back
+// identical, and the vector and scalar quantizers have to agree.
+bool ditherIsDeterministic() {
+    const sf_count_t frames = 48000;
+    AudioGenerator gen(1.0, 48000, {{440.0, 0.5, 0.0}, {1250.0, 0.5, 1.0}}, 2, std::make_shared<RenderPool>(3));
+    gen.setDither(true);
+    std::vector<int16_t> outputs[2];
+    const sf_count_t blockFrames[2] = {1000, 4133};
+    for (int i = 0; i < 2; ++i) {
+        std::string path = "roundtrip_dither" + std::to_string(i) + ".wav";
+        gen.streamToWav(path, blockFrames[i], SampleFormat::Pcm16);
+        SF_INFO sfinfo = {};
+        SNDFILE *infile = sf_open(path.c_str(), SFM_READ, &sfinfo);
+        if (!infile) {
+            std::cout << "dither: could not reopen " << path << std::endl;
+            return false;
+        }
+        outputs[i].resize(static_cast<size_t>(frames * 2));
+        sf_readf_short(infile, outputs[i].data(), frames);
+        sf_close(infile);
+        std::remove(path.c_str());
+    }
+
+    std::vector<float> mix(4099);
+    for (size_t i = 0; i < mix.size(); ++i) {
+        mix[i] = static_cast<float>(std::sin(i * 0.01) * 0.7);
+    }
+    std::vector<int16_t> vector(mix.size()), scalar(mix.size());
+    quantize::Dither first{(uint64_t(1) << 32) - 1000}, second = first; // crosses a 32-bit index boundary
+    quantize::convert(mix.data(), vector.data(), mix.size(), &first);
+    quantize::scalarToInt(mix.data(), scalar.data(), mix.size(), 32767.0f, 0, &second);
+
+    bool ok = outputs[0] == outputs[1] && vector == scalar && first.next == second.next;
+    std::cout << "dither: " << (ok ? "ok" : "MISMATCH") << std::endl;
+    return ok;
+}
+
+int roundTripAll() {
+    bool ok = roundTrip<int16_t>(SampleFormat::Pcm16, "pcm16");
+    ok = roundTrip<int32_t>(SampleFormat::Pcm24, "pcm24") && ok;
+    ok = roundTrip<float>(SampleFormat::Float32, "float") && ok;
+    ok = ditherIsDeterministic() && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Render + quantize throughput and end-to-end file throughput per format.
+template <typename Sample>
+void benchFormat(SampleFormat format, const char *name, bool dither) {
+    const sf_count_t frames = 1 << 22;
+    AudioGenerator gen(frames / 48000.0, 48000, {{440.0, 0.5, 0.0}, {1250.0, 0.5, 1.0}}, 2);
+    gen.setDither(dither);
+    std::vector<Sample> block(AudioGenerator::kDefaultBlockFrames * 2);
+
+    auto start = std::chrono::steady_clock::now();
+    for (sf_count_t offset = 0; offset < frames; offset += AudioGenerator::kDefaultBlockFrames) {
+        gen.renderBlock(offset, block.data(), AudioGenerator::kDefaultBlockFrames);
+    }
+    double render = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::string path = std::string("bench_") + name + ".wav";
+    start = std::chrono::steady_clock::now();
+    gen.streamToWav(path, 0, format);
+    double write = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::remove(path.c_str());
+
+    std::cout << name << (dither ? "+dither" : "") << ": render " << frames / render / 1e6 << " Mframes/s, to disk "
+              << frames * 2.0 * bytesPerSample(format) / write / 1e6 << " MB/s" << std::endl;
+}
+
+int benchFormats() {
+    for (bool dither : {false, true}) {
+        benchFormat<int16_t>(SampleFormat::Pcm16, "pcm16", dither);
+        benchFormat<int32_t>(SampleFormat::Pcm24, "pcm24", dither);
+    }
+    benchFormat<float>(SampleFormat::Float32, "float", false);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2 && std::string(argv[1]) == "--batch") {
+        try {
+            unsigned workers = std::thread::hardware_concurrency();
+            bool dither = false;
+            for (int i = 3; i < argc; ++i) {
+                std::string arg = argv[i];
+                if (arg == "--jobs" && i + 1 < argc) {
+                    workers = static_cast<unsigned>(std::stoul(argv[++i]));
+                } else if (arg == "--dither") {
+                    dither = true;
+                } else {
+                    throw std::invalid_argument("Unknown batch option: " + arg);
+                }
+            }
+            BatchRunner runner(workers, dither);
+            return runner.run(BatchRunner::readManifest(argv[2])) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        } catch (const std::exception &e) {
+            std::cerr << "Exception: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-oscillator") {
+        return benchOscillator();
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-mixer") {
+        return benchMixer();
+    }
+    if (argc > 1 && std::string(argv[1]) == "--roundtrip") {
+        return roundTripAll();
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-formats") {
+        return benchFormats();
+    }
+
+    try {
+        double duration = 5.0;  // 音频时长（秒）
+        int sampleRate = 44100; // 采样率
+        double frequency = 440;  // 正弦波频率（Hz）
+
+        AudioGenerator audioGen(duration, sampleRate, frequency);
+        audioGen.streamToWav("output.wav");
+        
+    } catch (const std::exception &e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -10,92 +10,1995 @@
 #include <fstream>
 #include <signal.h>
 #include <json/json.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <type_traits>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KICKAI_X86 1
+#endif
 
 #include "spdlog/spdlog.h"
 
+namespace sha256 {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+inline uint32_t loadBE(const uint8_t *p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+inline void storeBE(uint8_t *p, uint32_t x) {
+    p[0] = uint8_t(x >> 24);
+    p[1] = uint8_t(x >> 16);
+    p[2] = uint8_t(x >> 8);
+    p[3] = uint8_t(x);
+}
+
+// One compression of a 64-byte block given as 16 big-endian words.
+inline void transform(uint32_t state[8], const uint32_t block[16]) {
+    uint32_t w[64];
+    std::memcpy(w, block, 64);
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+// Plain SHA-256 of a whole message; used for job setup and checks, not in
+// the nonce loop.
+inline std::array<uint8_t, 32> digest(const uint8_t *data, size_t length) {
+    uint32_t state[8];
+    std::memcpy(state, IV, sizeof(state));
+    std::vector<uint8_t> message(data, data + length);
+    message.push_back(0x80);
+    while (message.size() % 64 != 56) {
+        message.push_back(0);
+    }
+    uint64_t bits = uint64_t(length) * 8;
+    for (int i = 7; i >= 0; --i) {
+        message.push_back(uint8_t(bits >> (8 * i)));
+    }
+    for (size_t offset = 0; offset < message.size(); offset += 64) {
+        uint32_t block[16];
+        for (int i = 0; i < 16; ++i) {
+            block[i] = loadBE(&message[offset + 4 * i]);
+        }
+        transform(state, block);
+    }
+    std::array<uint8_t, 32> out;
+    for (int i = 0; i < 8; ++i) {
+        storeBE(&out[4 * i], state[i]);
+    }
+    return out;
+}
+
+} // namespace sha256
+
+std::vector<uint8_t> parseHex(const std::string &hex) {
+    if (hex.size() % 2 != 0) {
+        throw std::invalid_argument("Odd-length hex string: " + hex);
+    }
+    std::vector<uint8_t> bytes(hex.size() / 2);
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        bytes[i] = static_cast<uint8_t>(std::stoul(hex.substr(2 * i, 2), nullptr, 16));
+    }
+    return bytes;
+}
+
+std::string toHex(const uint8_t *bytes, size_t length) {
+    std::ostringstream oss;
+    oss << std::hex << std::setfill('0');
+    for (size_t i = 0; i < length; ++i) {
+        oss << std::setw(2) << static_cast<int>(bytes[i]);
+    }
+    return oss.str();
+}
+
+// An 80-byte block header prepared for the nonce loop. The first 64 bytes
+// never change with the nonce, so their SHA-256 state (the midstate) is
+// computed once; each nonce then costs one compression for the rest of the
+// header and one for the second SHA-256. Trivially copyable, so it can be
+// published to the hashing threads through a seqlock.
+struct MiningJob {
+    uint8_t header[80];
+    uint32_t midstate[8];
+    uint32_t tail[16];     // second block: merkle root tail, time, bits, nonce, padding
+    uint8_t target[32];    // little-endian, as the hash is compared
+    uint32_t targetTop;    // most significant 32 bits of target, for the quick reject
+
+    uint32_t time() const { return header[68] | header[69] << 8 | header[70] << 16 | uint32_t(header[71]) << 24; }
+    uint32_t bits() const { return header[72] | header[73] << 8 | header[74] << 16 | uint32_t(header[75]) << 24; }
+};
+
+// Expands the compact "bits" encoding into a little-endian 256-bit target.
+void compactToTarget(uint32_t bits, uint8_t target[32]) {
+    std::memset(target, 0, 32);
+    int exponent = static_cast<int>(bits >> 24);
+    uint32_t mantissa = bits & 0x007fffff;
+    for (int i = 0; i < 3; ++i) {
+        int position = exponent - 3 + i;
+        if (position >= 0 && position < 32) {
+            target[position] = uint8_t(mantissa >> (8 * i));
+        }
+    }
+}
+
+// Replaces the target, e.g. with an easier share target.
+void setTarget(MiningJob &job, const uint8_t target[32]) {
+    std::memcpy(job.target, target, 32);
+    job.targetTop = uint32_t(target[31]) << 24 | uint32_t(target[30]) << 16 | uint32_t(target[29]) << 8 | target[28];
+}
+
+MiningJob makeJob(const uint8_t header[80]) {
+    MiningJob job;
+    std::memcpy(job.header, header, 80);
+    uint32_t block[16];
+    for (int i = 0; i < 16; ++i) {
+        block[i] = sha256::loadBE(header + 4 * i);
+    }
+    std::memcpy(job.midstate, sha256::IV, sizeof(job.midstate));
+    sha256::transform(job.midstate, block);
+    for (int i = 0; i < 4; ++i) {
+        job.tail[i] = sha256::loadBE(header + 64 + 4 * i);
+    }
+    job.tail[4] = 0x80000000;
+    for (int i = 5; i < 15; ++i) {
+        job.tail[i] = 0;
+    }
+    job.tail[15] = 80 * 8;
+    uint8_t target[32];
+    compactToTarget(job.bits(), target);
+    setTarget(job, target);
+    return job;
+}
+
+MiningJob makeJob(const std::string &headerHex) {
+    std::vector<uint8_t> header = parseHex(headerHex);
+    if (header.size() != 80) {
+        throw std::invalid_argument("A block header is 80 bytes, got " + std::to_string(header.size()));
+    }
+    return makeJob(header.data());
+}
+
+// SHA-256d of the job's header with the given nonce, as the eight state
+// words of the second hash.
+inline void hashNonce(const MiningJob &job, uint32_t nonce, uint32_t out[8]) {
+    uint32_t block[16];
+    std::memcpy(block, job.tail, sizeof(block));
+    block[3] = __builtin_bswap32(nonce); // the header stores the nonce little-endian
+    uint32_t first[8];
+    std::memcpy(first, job.midstate, sizeof(first));
+    sha256::transform(first, block);
+
+    uint32_t second[16] = {};
+    std::memcpy(second, first, sizeof(first));
+    second[8] = 0x80000000;
+    second[15] = 32 * 8;
+    std::memcpy(out, sha256::IV, 32);
+    sha256::transform(out, second);
+}
+
+// Hash bytes in the order they are compared (little-endian number).
+inline void hashBytes(const uint32_t state[8], uint8_t out[32]) {
+    for (int i = 0; i < 8; ++i) {
+        sha256::storeBE(out + 4 * i, state[i]);
+    }
+}
+
+// Block explorers show the hash as a big-endian number.
+std::string displayHash(const uint32_t state[8]) {
+    uint8_t bytes[32];
+    hashBytes(state, bytes);
+    std::reverse(bytes, bytes + 32);
+    return toHex(bytes, 32);
+}
+
+inline bool meetsTarget(const MiningJob &job, const uint32_t state[8]) {
+    uint32_t top = __builtin_bswap32(state[7]);
+    if (top != job.targetTop) {
+        return top < job.targetTop;
+    }
+    uint8_t bytes[32];
+    hashBytes(state, bytes);
+    for (int i = 31; i >= 0; --i) {
+        if (bytes[i] != job.target[i]) {
+            return bytes[i] < job.target[i];
+        }
+    }
+    return true;
+}
+
+// Interchangeable implementations of the nonce loop. Each one tries count
+// nonces from first and, on the first hash meeting the job's target, stores
+// the nonce and that hash's state words and returns true. The SIMD paths
+// hash one nonce per lane and finish any remainder on the scalar path.
+namespace hashing {
+
+using Kernel = bool (*)(const MiningJob &job, uint32_t first, uint32_t count, uint32_t &nonce, uint32_t state[8]);
+
+inline bool scalarScan(const MiningJob &job, uint32_t first, uint32_t count, uint32_t &nonce, uint32_t state[8]) {
+    for (uint32_t i = 0; i < count; ++i) {
+        hashNonce(job, first + i, state);
+        if (__builtin_bswap32(state[7]) <= job.targetTop && meetsTarget(job, state)) {
+            nonce = first + i;
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef KICKAI_X86
+// Intel SHA extensions: sha256rnds2 does two rounds on the state held as
+// ABEF/CDGH pairs, sha256msg1/msg2 extend the message schedule. The rounds
+// are a serial dependency chain, so Streams independent blocks are
+// interleaved to keep the unit busy.
+template <int Streams>
+__attribute__((target("sha,sse4.1")))
+inline void shaniTransform(uint32_t *const state[Streams], const uint32_t *const block[Streams]) {
+    __m128i state0[Streams], state1[Streams], abef[Streams], cdgh[Streams];
+    __m128i msg[Streams][4];
+    for (int n = 0; n < Streams; ++n) {
+        __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state[n]));
+        state1[n] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state[n] + 4));
+        tmp = _mm_shuffle_epi32(tmp, 0xB1);
+        state1[n] = _mm_shuffle_epi32(state1[n], 0x1B);
+        state0[n] = _mm_alignr_epi8(tmp, state1[n], 8);
+        state1[n] = _mm_blend_epi16(state1[n], tmp, 0xF0);
+        abef[n] = state0[n];
+        cdgh[n] = state1[n];
+        for (int i = 0; i < 4; ++i) {
+            msg[n][i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block[n] + 4 * i));
+        }
+    }
+#pragma GCC unroll 16
+    for (int group = 0; group < 16; ++group) {
+        const __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i *>(sha256::K + 4 * group));
+        for (int n = 0; n < Streams; ++n) {
+            __m128i current = msg[n][group & 3];
+            __m128i rounds = _mm_add_epi32(current, k);
+            state1[n] = _mm_sha256rnds2_epu32(state1[n], state0[n], rounds);
+            if (group >= 3 && group <= 14) {
+                __m128i &next = msg[n][(group + 1) & 3];
+                next = _mm_add_epi32(next, _mm_alignr_epi8(current, msg[n][(group + 3) & 3], 4));
+                next = _mm_sha256msg2_epu32(next, current);
+            }
+            state0[n] = _mm_sha256rnds2_epu32(state0[n], state1[n], _mm_shuffle_epi32(rounds, 0x0E));
+            if (group >= 1 && group <= 12) {
+                __m128i &previous = msg[n][(group + 3) & 3];
+                previous = _mm_sha256msg1_epu32(previous, current);
+            }
+        }
+    }
+
+    for (int n = 0; n < Streams; ++n) {
+        state0[n] = _mm_add_epi32(state0[n], abef[n]);
+        state1[n] = _mm_add_epi32(state1[n], cdgh[n]);
+        __m128i tmp = _mm_shuffle_epi32(state0[n], 0x1B);
+        state1[n] = _mm_shuffle_epi32(state1[n], 0xB1);
+        state0[n] = _mm_blend_epi16(tmp, state1[n], 0xF0);
+        state1[n] = _mm_alignr_epi8(state1[n], tmp, 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state[n]), state0[n]);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state[n] + 4), state1[n]);
+    }
+}
+
+__attribute__((target("sha,sse4.1")))
+inline bool shaniScan(const MiningJob &job, uint32_t first, uint32_t count, uint32_t &nonce, uint32_t state[8]) {
+    constexpr int kStreams = 4; // best of 1..8 on a Xeon with SHA-NI
+    uint32_t blocks[kStreams][16];
+    uint32_t seconds[kStreams][16] = {};
+    uint32_t outs[kStreams][8];
+    uint32_t *firstStates[kStreams], *secondStates[kStreams];
+    const uint32_t *firstBlocks[kStreams], *secondBlocks[kStreams];
+    for (int n = 0; n < kStreams; ++n) {
+        std::memcpy(blocks[n], job.tail, sizeof(blocks[n]));
+        seconds[n][8] = 0x80000000;
+        seconds[n][15] = 32 * 8;
+        firstStates[n] = seconds[n];
+        firstBlocks[n] = blocks[n];
+        secondStates[n] = outs[n];
+        secondBlocks[n] = seconds[n];
+    }
+    uint32_t i = 0;
+    for (; count - i >= kStreams; i += kStreams) {
+        for (int n = 0; n < kStreams; ++n) {
+            blocks[n][3] = __builtin_bswap32(first + i + n);
+            std::memcpy(seconds[n], job.midstate, 32);
+            std::memcpy(outs[n], sha256::IV, 32);
+        }
+        shaniTransform<kStreams>(firstStates, firstBlocks);
+        shaniTransform<kStreams>(secondStates, secondBlocks);
+        for (int n = 0; n < kStreams; ++n) {
+            if (__builtin_bswap32(outs[n][7]) <= job.targetTop && meetsTarget(job, outs[n])) {
+                nonce = first + i + n;
+                std::memcpy(state, outs[n], 32);
+                return true;
+            }
+        }
+    }
+    return scalarScan(job, first + i, count - i, nonce, state);
+}
+
+template <int N>
+__attribute__((target("avx2"))) inline __m256i rotr8(__m256i x) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, N), _mm256_slli_epi32(x, 32 - N));
+}
+
+// Eight independent compressions, one per 32-bit lane. w[0..15] holds the
+// block; the rest of w is scratch for the message schedule.
+__attribute__((target("avx2")))
+inline void avx2Transform(__m256i s[8], __m256i w[64]) {
+    for (int i = 16; i < 64; ++i) {
+        __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(rotr8<7>(w[i - 15]), rotr8<18>(w[i - 15])),
+                                      _mm256_srli_epi32(w[i - 15], 3));
+        __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(rotr8<17>(w[i - 2]), rotr8<19>(w[i - 2])),
+                                      _mm256_srli_epi32(w[i - 2], 10));
+        w[i] = _mm256_add_epi32(_mm256_add_epi32(w[i - 16], s0), _mm256_add_epi32(w[i - 7], s1));
+    }
+    __m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; ++i) {
+        __m256i sigma1 = _mm256_xor_si256(_mm256_xor_si256(rotr8<6>(e), rotr8<11>(e)), rotr8<25>(e));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sigma1),
+                                      _mm256_add_epi32(ch, _mm256_add_epi32(_mm256_set1_epi32(int(sha256::K[i])), w[i])));
+        __m256i sigma0 = _mm256_xor_si256(_mm256_xor_si256(rotr8<2>(a), rotr8<13>(a)), rotr8<22>(a));
+        __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, _mm256_add_epi32(sigma0, maj));
+    }
+    s[0] = _mm256_add_epi32(s[0], a);
+    s[1] = _mm256_add_epi32(s[1], b);
+    s[2] = _mm256_add_epi32(s[2], c);
+    s[3] = _mm256_add_epi32(s[3], d);
+    s[4] = _mm256_add_epi32(s[4], e);
+    s[5] = _mm256_add_epi32(s[5], f);
+    s[6] = _mm256_add_epi32(s[6], g);
+    s[7] = _mm256_add_epi32(s[7], h);
+}
+
+__attribute__((target("avx2")))
+inline bool avx2Scan(const MiningJob &job, uint32_t first, uint32_t count, uint32_t &nonce, uint32_t state[8]) {
+    const __m256i swap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i limit = _mm256_set1_epi32(int(job.targetTop));
+    uint32_t i = 0;
+    for (; count - i >= 8; i += 8) {
+        __m256i w[64];
+        __m256i s[8];
+        for (int j = 0; j < 16; ++j) {
+            w[j] = _mm256_set1_epi32(int(job.tail[j]));
+        }
+        w[3] = _mm256_shuffle_epi8(_mm256_add_epi32(_mm256_set1_epi32(int(first + i)), lanes), swap);
+        for (int j = 0; j < 8; ++j) {
+            s[j] = _mm256_set1_epi32(int(job.midstate[j]));
+        }
+        avx2Transform(s, w);
+
+        for (int j = 0; j < 8; ++j) {
+            w[j] = s[j];
+            s[j] = _mm256_set1_epi32(int(sha256::IV[j]));
+        }
+        w[8] = _mm256_set1_epi32(int(0x80000000));
+        for (int j = 9; j < 15; ++j) {
+            w[j] = _mm256_setzero_si256();
+        }
+        w[15] = _mm256_set1_epi32(32 * 8);
+        avx2Transform(s, w);
+
+        // Unsigned top <= limit, as max(top, limit) == limit.
+        __m256i top = _mm256_shuffle_epi8(s[7], swap);
+        int candidates = _mm256_movemask_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_max_epu32(top, limit), limit)));
+        while (candidates) {
+            int lane = __builtin_ctz(candidates);
+            candidates &= candidates - 1;
+            alignas(32) uint32_t words[8];
+            for (int j = 0; j < 8; ++j) {
+                _mm256_store_si256(reinterpret_cast<__m256i *>(words), s[j]);
+                state[j] = words[lane];
+            }
+            if (meetsTarget(job, state)) {
+                nonce = first + i + static_cast<uint32_t>(lane);
+                return true;
+            }
+        }
+    }
+    return scalarScan(job, first + i, count - i, nonce, state);
+}
+
+// The zero-masking forms with a full mask are the same instructions; the
+// unmasked intrinsics trip a false uninitialized warning in GCC's headers.
+template <int N>
+__attribute__((target("avx512f"))) inline __m512i rotr16(__m512i x) {
+    return _mm512_maskz_ror_epi32(0xffff, x, N);
+}
+
+template <int N>
+__attribute__((target("avx512f"))) inline __m512i shr16(__m512i x) {
+    return _mm512_maskz_srli_epi32(0xffff, x, N);
+}
+
+// Sixteen lanes with native rotates; ternary logic folds the three-way XORs,
+// Ch and Maj into one instruction each.
+__attribute__((target("avx512f")))
+inline void avx512Transform(__m512i s[8], __m512i w[64]) {
+    for (int i = 16; i < 64; ++i) {
+        __m512i s0 = _mm512_ternarylogic_epi32(rotr16<7>(w[i - 15]), rotr16<18>(w[i - 15]),
+                                               shr16<3>(w[i - 15]), 0x96);
+        __m512i s1 = _mm512_ternarylogic_epi32(rotr16<17>(w[i - 2]), rotr16<19>(w[i - 2]),
+                                               shr16<10>(w[i - 2]), 0x96);
+        w[i] = _mm512_add_epi32(_mm512_add_epi32(w[i - 16], s0), _mm512_add_epi32(w[i - 7], s1));
+    }
+    __m512i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; ++i) {
+        __m512i sigma1 = _mm512_ternarylogic_epi32(rotr16<6>(e), rotr16<11>(e), rotr16<25>(e), 0x96);
+        __m512i ch = _mm512_ternarylogic_epi32(e, f, g, 0xCA);
+        __m512i t1 = _mm512_add_epi32(_mm512_add_epi32(h, sigma1),
+                                      _mm512_add_epi32(ch, _mm512_add_epi32(_mm512_set1_epi32(int(sha256::K[i])), w[i])));
+        __m512i sigma0 = _mm512_ternarylogic_epi32(rotr16<2>(a), rotr16<13>(a), rotr16<22>(a), 0x96);
+        __m512i maj = _mm512_ternarylogic_epi32(a, b, c, 0xE8);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm512_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm512_add_epi32(t1, _mm512_add_epi32(sigma0, maj));
+    }
+    s[0] = _mm512_add_epi32(s[0], a);
+    s[1] = _mm512_add_epi32(s[1], b);
+    s[2] = _mm512_add_epi32(s[2], c);
+    s[3] = _mm512_add_epi32(s[3], d);
+    s[4] = _mm512_add_epi32(s[4], e);
+    s[5] = _mm512_add_epi32(s[5], f);
+    s[6] = _mm512_add_epi32(s[6], g);
+    s[7] = _mm512_add_epi32(s[7], h);
+}
+
+// Byte swap of each lane with AVX-512F only (no byte shuffles before BW).
+__attribute__((target("avx512f")))
+inline __m512i bswap16(__m512i x) {
+    return _mm512_ternarylogic_epi32(rotr16<8>(x), rotr16<24>(x),
+                                     _mm512_set1_epi32(int(0xff00ff00)), 0xE4);
+}
+
+__attribute__((target("avx512f")))
+inline bool avx512Scan(const MiningJob &job, uint32_t first, uint32_t count, uint32_t &nonce, uint32_t state[8]) {
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i limit = _mm512_set1_epi32(int(job.targetTop));
+    uint32_t i = 0;
+    for (; count - i >= 16; i += 16) {
+        __m512i w[64];
+        __m512i s[8];
+        for (int j = 0; j < 16; ++j) {
+            w[j] = _mm512_set1_epi32(int(job.tail[j]));
+        }
+        w[3] = bswap16(_mm512_add_epi32(_mm512_set1_epi32(int(first + i)), lanes));
+        for (int j = 0; j < 8; ++j) {
+            s[j] = _mm512_set1_epi32(int(job.midstate[j]));
+        }
+        avx512Transform(s, w);
+
+        for (int j = 0; j < 8; ++j) {
+            w[j] = s[j];
+            s[j] = _mm512_set1_epi32(int(sha256::IV[j]));
+        }
+        w[8] = _mm512_set1_epi32(int(0x80000000));
+        for (int j = 9; j < 15; ++j) {
+            w[j] = _mm512_setzero_si512();
+        }
+        w[15] = _mm512_set1_epi32(32 * 8);
+        avx512Transform(s, w);
+
+        __mmask16 candidates = _mm512_cmple_epu32_mask(bswap16(s[7]), limit);
+        while (candidates) {
+            int lane = __builtin_ctz(candidates);
+            candidates &= candidates - 1;
+            alignas(64) uint32_t words[16];
+            for (int j = 0; j < 8; ++j) {
+                _mm512_store_si512(words, s[j]);
+                state[j] = words[lane];
+            }
+            if (meetsTarget(job, state)) {
+                nonce = first + i + static_cast<uint32_t>(lane);
+                return true;
+            }
+        }
+    }
+    return scalarScan(job, first + i, count - i, nonce, state);
+}
+#endif
+
+struct Path {
+    const char *name;
+    Kernel kernel;
+};
+
+// Every backend usable on this CPU, fastest first.
+inline std::vector<Path> availablePaths() {
+    std::vector<Path> paths;
+#ifdef KICKAI_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        paths.push_back({"avx512", avx512Scan});
+    }
+    if (__builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1")) {
+        paths.push_back({"sha-ni", shaniScan});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        paths.push_back({"avx2", avx2Scan});
+    }
+#endif
+    paths.push_back({"scalar", scalarScan});
+    return paths;
+}
+
+// The named backend, or the fastest one when name is empty.
+inline Path select(const std::string &name) {
+    std::vector<Path> paths = availablePaths();
+    if (name.empty()) {
+        return paths.front();
+    }
+    std::string names;
+    for (const Path &path : paths) {
+        if (name == path.name) {
+            return path;
+        }
+        names += std::string(names.empty() ? "" : ", ") + path.name;
+    }
+    throw std::invalid_argument("Backend " + name + " is not available on this CPU (available: " + names + ")");
+}
+
+} // namespace hashing
+
+// Single-writer seqlock. The writer makes the sequence odd, stores the
+// words, then makes it even again; a reader retries if the sequence was odd
+// or moved while it copied. Readers never block the writer or each other,
+// and checking for new data is one load of the sequence.
+template <typename T>
+class SeqLockSlot {
+    static_assert(std::is_trivially_copyable<T>::value, "seqlock payloads are copied word by word");
+
+public:
+    uint64_t sequence() const {
+        return seq.load(std::memory_order_acquire);
+    }
+
+    void store(const T &value) {
+        uint64_t words[kWords] = {};
+        std::memcpy(words, &value, sizeof(T));
+        uint64_t current = seq.load(std::memory_order_relaxed);
+        seq.store(current + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < kWords; ++i) {
+            data[i].store(words[i], std::memory_order_relaxed);
+        }
+        seq.store(current + 2, std::memory_order_release);
+    }
+
+    // Copies the current value; returns the sequence it belongs to.
+    uint64_t load(T &value) const {
+        uint64_t words[kWords];
+        for (;;) {
+            uint64_t before = seq.load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            for (size_t i = 0; i < kWords; ++i) {
+                words[i] = data[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == before) {
+                std::memcpy(&value, words, sizeof(T));
+                return before;
+            }
+        }
+    }
+
+private:
+    static constexpr size_t kWords = (sizeof(T) + 7) / 8;
+    alignas(64) std::atomic<uint64_t> seq{0};
+    std::atomic<uint64_t> data[kWords];
+};
+
+inline int64_t steadyNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+struct Share {
+    uint64_t generation; // which publish() the share belongs to
+    uint32_t nonce;
+    uint32_t hash[8];
+};
+
+// Job-switch latency histogram: bucket b counts switches that took at most
+// 2^b microseconds, the last bucket everything slower.
+constexpr size_t kSwitchBuckets = 22;
+
+inline size_t switchBucket(uint64_t nanos) {
+    uint64_t micros = (nanos + 999) / 1000;
+    size_t bucket = micros <= 1 ? 0 : static_cast<size_t>(64 - __builtin_clzll(micros - 1));
+    return std::min(bucket, kSwitchBuckets - 1);
+}
+
+// Upper bound, in microseconds, of the switch latency at quantile q; 0 if
+// the histogram is empty, UINT64_MAX past the last bucket.
+inline uint64_t histogramQuantileMicros(const std::array<uint64_t, kSwitchBuckets> &histogram, double q) {
+    uint64_t total = 0;
+    for (uint64_t count : histogram) {
+        total += count;
+    }
+    uint64_t seen = 0;
+    for (size_t b = 0; b < kSwitchBuckets; ++b) {
+        seen += histogram[b];
+        if (total > 0 && seen >= q * total) {
+            return b + 1 == kSwitchBuckets ? UINT64_MAX : uint64_t(1) << b;
+        }
+    }
+    return 0;
+}
+
+// Counters summed over the hashing threads at one instant.
+struct EngineStats {
+    std::vector<uint64_t> threadHashes;
+    std::vector<int> threadCpus;
+    uint64_t hashes = 0;
+    uint64_t shares = 0; // hashes that met the job's target
+    uint64_t switches = 0;
+    uint64_t switchNs = 0;
+    uint64_t maxSwitchNs = 0;
+    std::array<uint64_t, kSwitchBuckets> switchHistogram{};
+};
+
+// Long-lived hashing threads, each pinned to one core. publish() hands all
+// of them new work through a seqlock slot; each thread takes its slice of
+// the work's nonce range and looks at the slot between batches of kBatch
+// nonces, so a new job replaces the old one within a batch and the hot path
+// takes no lock. A thread that finishes its slice reports it and sleeps
+// until the next publish.
+class HashingEngine {
+public:
+    static constexpr uint32_t kBatch = 1024;
+
+    using ShareHandler = std::function<void(const Share &)>;
+    using ExhaustedHandler = std::function<void(uint64_t generation)>;
+
+    HashingEngine(int threads, hashing::Kernel kernel, ShareHandler onShare, ExhaustedHandler onExhausted = nullptr)
+        : kernel(kernel), onShare(std::move(onShare)), onExhausted(std::move(onExhausted)) {
+        threads = std::max(1, threads);
+        unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+        for (int i = 0; i < threads; ++i) {
+            workers.push_back(std::make_unique<Worker>());
+            workers.back()->cpu = static_cast<int>(i % cpus);
+        }
+        for (int i = 0; i < threads; ++i) {
+            Worker &worker = *workers[i];
+            worker.thread = std::thread([this, i] { run(i); });
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            CPU_SET(worker.cpu, &mask);
+            if (pthread_setaffinity_np(worker.thread.native_handle(), sizeof(mask), &mask) != 0) {
+                spdlog::warn("Could not pin mining thread {} to CPU {}", i, worker.cpu);
+            }
+        }
+    }
+
+    ~HashingEngine() {
+        stop();
+    }
+
+    // Replaces the work of every thread; nonces [begin, end) are split evenly
+    // between them. Only one thread may publish.
+    uint64_t publish(const MiningJob &job, uint64_t begin = 0, uint64_t end = uint64_t(1) << 32) {
+        Work work;
+        work.job = job;
+        work.generation = ++generation;
+        work.begin = begin;
+        work.end = std::max(begin, end);
+        work.publishedNs = steadyNanos();
+        slot.store(work);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+        }
+        workChanged.notify_all();
+        return work.generation;
+    }
+
+    // Blocks until every thread has finished its slice of generation.
+    void waitIdle(uint64_t generation) {
+        std::unique_lock<std::mutex> lock(mutex);
+        idleChanged.wait(lock, [&] {
+            return stopping || std::all_of(workers.begin(), workers.end(), [&](const std::unique_ptr<Worker> &w) {
+                       return w->idleGeneration >= generation;
+                   });
+        });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                return;
+            }
+            stopping = true;
+        }
+        workChanged.notify_all();
+        idleChanged.notify_all();
+        for (auto &worker : workers) {
+            worker->thread.join();
+        }
+    }
+
+    uint64_t totalHashes() const {
+        uint64_t total = 0;
+        for (auto &worker : workers) {
+            total += worker->hashes.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // Reads every thread's counters. Only reads: the hashing threads never
+    // wait for it and never see their lines written by another core.
+    EngineStats stats() const {
+        EngineStats stats;
+        for (auto &worker : workers) {
+            uint64_t hashes = worker->hashes.load(std::memory_order_relaxed);
+            stats.threadHashes.push_back(hashes);
+            stats.threadCpus.push_back(worker->cpu);
+            stats.hashes += hashes;
+            stats.shares += worker->shares.load(std::memory_order_relaxed);
+            stats.switches += worker->switches.load(std::memory_order_relaxed);
+            stats.switchNs += worker->switchNs.load(std::memory_order_relaxed);
+            stats.maxSwitchNs = std::max<uint64_t>(stats.maxSwitchNs, worker->maxSwitchNs.load(std::memory_order_relaxed));
+            for (size_t b = 0; b < kSwitchBuckets; ++b) {
+                stats.switchHistogram[b] += worker->switchHistogram[b].load(std::memory_order_relaxed);
+            }
+        }
+        return stats;
+    }
+
+private:
+    struct Work {
+        MiningJob job;
+        uint64_t generation;
+        uint64_t begin;
+        uint64_t end;
+        int64_t publishedNs; // steady clock, for the job-switch latency
+    };
+
+    // One per thread, cache-line aligned so no two threads' counters share a
+    // line. Each counter has a single writer, its own thread, which updates
+    // it with a plain load and store instead of a locked read-modify-write.
+    struct alignas(64) Worker {
+        std::atomic<uint64_t> hashes{0};
+        std::atomic<uint64_t> shares{0};
+        std::atomic<uint64_t> switches{0};
+        std::atomic<uint64_t> switchNs{0};
+        std::atomic<uint64_t> maxSwitchNs{0};
+        std::atomic<uint64_t> switchHistogram[kSwitchBuckets] = {};
+
+        alignas(64) std::thread thread; // cold from here on
+        int cpu = 0;
+        uint64_t idleGeneration = 0; // guarded by mutex
+    };
+
+    static void bump(std::atomic<uint64_t> &counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    hashing::Kernel kernel;
+    ShareHandler onShare;
+    ExhaustedHandler onExhausted;
+    SeqLockSlot<Work> slot;
+    std::vector<std::unique_ptr<Worker>> workers;
+    uint64_t generation = 0; // publisher only
+
+    std::mutex mutex; // idle/wake-up hand-off only, never while hashing
+    std::condition_variable workChanged;
+    std::condition_variable idleChanged;
+    std::atomic<bool> stopping{false}; // also polled between batches
+
+    void run(int index) {
+        Worker &self = *workers[index];
+        const uint64_t threads = workers.size();
+        Work work{};
+        uint64_t seen = 0;
+        uint64_t next = 0, to = 0;
+        uint32_t state[8];
+        for (;;) {
+            uint64_t sequence = slot.sequence();
+            if (sequence != seen) {
+                seen = slot.load(work);
+                uint64_t span = work.end - work.begin;
+                next = work.begin + span * index / threads;
+                to = work.begin + span * (index + 1) / threads;
+                uint64_t latency = static_cast<uint64_t>(std::max<int64_t>(0, steadyNanos() - work.publishedNs));
+                bump(self.switches, 1);
+                bump(self.switchNs, latency);
+                bump(self.switchHistogram[switchBucket(latency)], 1);
+                if (latency > self.maxSwitchNs.load(std::memory_order_relaxed)) {
+                    self.maxSwitchNs.store(latency, std::memory_order_relaxed);
+                }
+            }
+
+            if (next >= to) {
+                bool finished = false;
+                std::unique_lock<std::mutex> lock(mutex);
+                if (seen != 0 && self.idleGeneration < work.generation) {
+                    self.idleGeneration = work.generation;
+                    finished = true;
+                    idleChanged.notify_all();
+                }
+                if (finished && onExhausted) {
+                    lock.unlock();
+                    onExhausted(work.generation);
+                    lock.lock();
+                }
+                workChanged.wait(lock, [&] { return stopping || slot.sequence() != seen; });
+                if (stopping) {
+                    return;
+                }
+                continue;
+            }
+            if (stopping.load(std::memory_order_relaxed)) {
+                return;
+            }
+
+            uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(kBatch, to - next));
+            uint32_t nonce;
+            if (kernel(work.job, static_cast<uint32_t>(next), count, nonce, state)) {
+                bump(self.hashes, nonce - next + 1);
+                bump(self.shares, 1);
+                Share share;
+                share.generation = work.generation;
+                share.nonce = nonce;
+                std::memcpy(share.hash, state, sizeof(share.hash));
+                onShare(share);
+                next = uint64_t(nonce) + 1;
+            } else {
+                bump(self.hashes, count);
+                next += count;
+            }
+        }
+    }
+};
+
+// Shares and finished slices reported by the hashing threads, handed to the
+// thread that owns the pool connection. The eventfd lets that thread wait on
+// it alongside the socket. Touched once per share or slice, never per hash.
+class MinerEvents {
+public:
+    MinerEvents() : fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+        if (fd < 0) {
+            throw std::runtime_error(std::string("eventfd: ") + std::strerror(errno));
+        }
+    }
+
+    ~MinerEvents() {
+        close(fd);
+    }
+
+    int descriptor() const {
+        return fd;
+    }
+
+    void share(const Share &share) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            shares.push_back(share);
+        }
+        signal();
+    }
+
+    void exhausted(uint64_t generation) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(generation);
+        }
+        signal();
+    }
+
+    // Waits for an event, or for stopFd to become readable.
+    bool wait(int timeoutMs, int stopFd = -1) {
+        pollfd events[2] = {{fd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+        return ::poll(events, stopFd < 0 ? 1 : 2, timeoutMs) > 0;
+    }
+
+    void drain(std::vector<Share> &sharesOut, std::vector<uint64_t> &finishedOut) {
+        uint64_t count;
+        while (read(fd, &count, sizeof(count)) > 0) {
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        sharesOut.swap(shares);
+        finishedOut.swap(finished);
+        shares.clear();
+        finished.clear();
+    }
+
+private:
+    int fd;
+    std::mutex mutex;
+    std::vector<Share> shares;
+    std::vector<uint64_t> finished;
+
+    void signal() {
+        uint64_t one = 1;
+        ssize_t written = write(fd, &one, sizeof(one));
+        (void)written; // a full counter still wakes the reader
+    }
+};
+
+// Pool verdicts on submitted shares, and the shares never submitted.
+struct ShareCounts {
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+    uint64_t stale = 0;     // the pool answered "job not found": it had moved on
+    uint64_t discarded = 0; // dropped unsent: the job was replaced, or the session lost
+};
+
+// Hash rates over sliding 1 s / 1 min / 15 min windows, and the text forms
+// of the miner's counters: a compact log line and a Prometheus text file.
+// Sampled about once a second from the control thread; it reads the hashing
+// threads' counters through EngineStats and never writes to them.
+class Telemetry {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void sample(const EngineStats &stats, Clock::time_point now = Clock::now()) {
+        latest = stats;
+        samples.push_back({now, stats.hashes});
+        while (now - samples.front().time > std::chrono::minutes(15) + std::chrono::seconds(2)) {
+            samples.pop_front();
+        }
+    }
+
+    // Hashes per second over the last window, or over everything sampled so
+    // far if the miner is younger than that.
+    double rate(std::chrono::seconds window) const {
+        if (samples.size() < 2) {
+            return 0;
+        }
+        const Sample &last = samples.back();
+        auto from = samples.rbegin() + 1;
+        // Samples arrive roughly a second apart, so allow some slack.
+        while (from + 1 != samples.rend() && last.time - (from + 1)->time <= window + std::chrono::milliseconds(200)) {
+            ++from;
+        }
+        double seconds = std::chrono::duration<double>(last.time - from->time).count();
+        return seconds > 0 ? (last.hashes - from->hashes) / seconds : 0;
+    }
+
+    uint64_t switchQuantileMicros(double q) const {
+        return histogramQuantileMicros(latest.switchHistogram, q);
+    }
+
+    std::string logLine(const ShareCounts &shares) const {
+        auto bound = [](uint64_t micros) {
+            return micros == UINT64_MAX ? std::string(">1 s") : "<=" + std::to_string(micros) + " us";
+        };
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(2) << "Hashrate " << rate(std::chrono::seconds(1)) / 1e6 << " / "
+            << rate(std::chrono::minutes(1)) / 1e6 << " / " << rate(std::chrono::minutes(15)) / 1e6
+            << " MH/s (1s/1m/15m) | shares " << latest.shares << " found, " << shares.accepted << " accepted, "
+            << shares.rejected << " rejected, " << shares.stale << " stale, " << shares.discarded
+            << " discarded | job switch p50 "
+            << bound(switchQuantileMicros(0.5)) << ", p99 " << bound(switchQuantileMicros(0.99)) << ", max "
+            << latest.maxSwitchNs / 1000 << " us";
+        return oss.str();
+    }
+
+    std::string prometheus(const ShareCounts &shares) const {
+        std::ostringstream oss;
+        oss << "# HELP kickai_miner_hashes_total Nonces hashed, per thread.\n"
+            << "# TYPE kickai_miner_hashes_total counter\n";
+        for (size_t i = 0; i < latest.threadHashes.size(); ++i) {
+            oss << "kickai_miner_hashes_total{thread=\"" << i << "\",cpu=\"" << latest.threadCpus[i] << "\"} "
+                << latest.threadHashes[i] << "\n";
+        }
+        oss << "# HELP kickai_miner_hashrate Hashes per second over a sliding window.\n"
+            << "# TYPE kickai_miner_hashrate gauge\n"
+            << "kickai_miner_hashrate{window=\"1s\"} " << rate(std::chrono::seconds(1)) << "\n"
+            << "kickai_miner_hashrate{window=\"1m\"} " << rate(std::chrono::minutes(1)) << "\n"
+            << "kickai_miner_hashrate{window=\"15m\"} " << rate(std::chrono::minutes(15)) << "\n"
+            << "# HELP kickai_miner_shares_found_total Hashes that met the share target.\n"
+            << "# TYPE kickai_miner_shares_found_total counter\n"
+            << "kickai_miner_shares_found_total " << latest.shares << "\n"
+            << "# HELP kickai_miner_shares_total Shares by the pool's verdict, or discarded unsent.\n"
+            << "# TYPE kickai_miner_shares_total counter\n"
+            << "kickai_miner_shares_total{result=\"accepted\"} " << shares.accepted << "\n"
+            << "kickai_miner_shares_total{result=\"rejected\"} " << shares.rejected << "\n"
+            << "kickai_miner_shares_total{result=\"stale\"} " << shares.stale << "\n"
+            << "kickai_miner_shares_total{result=\"discarded\"} " << shares.discarded << "\n"
+            << "# HELP kickai_miner_job_switch_seconds Time from publishing work to a thread hashing it.\n"
+            << "# TYPE kickai_miner_job_switch_seconds histogram\n";
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b < kSwitchBuckets; ++b) {
+            cumulative += latest.switchHistogram[b];
+            oss << "kickai_miner_job_switch_seconds_bucket{le=\"";
+            if (b + 1 == kSwitchBuckets) {
+                oss << "+Inf";
+            } else {
+                oss << std::ldexp(1e-6, static_cast<int>(b));
+            }
+            oss << "\"} " << cumulative << "\n";
+        }
+        oss << "kickai_miner_job_switch_seconds_sum " << latest.switchNs / 1e9 << "\n"
+            << "kickai_miner_job_switch_seconds_count " << latest.switches << "\n";
+        return oss.str();
+    }
+
+    // Replaces path atomically, so a scraper never reads half a file.
+    void writeFile(const std::string &path, const ShareCounts &shares) const {
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream out(temporary, std::ios::trunc);
+            out << prometheus(shares);
+            if (!out) {
+                throw std::runtime_error("Could not write " + temporary);
+            }
+        }
+        if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Could not replace " + path + ": " + std::strerror(errno));
+        }
+    }
+
+private:
+    struct Sample {
+        Clock::time_point time;
+        uint64_t hashes;
+    };
+
+    std::deque<Sample> samples;
+    EngineStats latest;
+};
+
+std::array<uint8_t, 32> sha256d(const uint8_t *data, size_t length) {
+    auto once = sha256::digest(data, length);
+    return sha256::digest(once.data(), once.size());
+}
+
+// Share target for a pool difficulty: the difficulty-1 target 0xffff * 2^208
+// divided by the difficulty, little-endian. Rounds down, so a share that
+// meets it always meets the pool's exact target.
+void difficultyToTarget(double difficulty, uint8_t target[32]) {
+    if (!(difficulty > 0)) {
+        throw std::invalid_argument("Pool difficulty must be positive");
+    }
+    long double remaining = std::ldexp(65535.0L, 208) / difficulty;
+    for (int i = 31; i >= 0; --i) {
+        long double scale = std::ldexp(1.0L, 8 * i);
+        long double byte = std::floor(remaining / scale);
+        if (byte > 255) {
+            std::memset(target, 0xff, 32); // easier than any 256-bit target
+            return;
+        }
+        target[i] = static_cast<uint8_t>(byte);
+        remaining -= byte * scale;
+    }
+}
+
+uint32_t parseWord(const std::string &hex) {
+    if (hex.size() != 8) {
+        throw std::runtime_error("Expected 8 hex digits, got " + hex);
+    }
+    return static_cast<uint32_t>(std::stoul(hex, nullptr, 16));
+}
+
+// The extranonce2 size from a mining.subscribe reply. The miner counts
+// extranonce2 in 64 bits, so a size outside 1..8 bytes cannot be honoured,
+// and padding or cutting it would make every submit malformed.
+size_t extranonce2Size(const Json::Value &size) {
+    if (!size.isUInt() || size.asUInt() < 1 || size.asUInt() > 8) {
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        throw std::runtime_error("Unsupported extranonce2 size " + Json::writeString(builder, size) +
+                                 " (expected 1 to 8 bytes)");
+    }
+    return size.asUInt();
+}
+
+// A mining.notify job; hex fields are kept as the pool sent them.
+struct StratumJob {
+    std::string jobId;
+    std::string prevHash;
+    std::string coinbase1;
+    std::string coinbase2;
+    std::vector<std::string> merkleBranch;
+    std::string version;
+    std::string bits;
+    std::string time;
+    bool clean = false;
+};
+
+StratumJob parseNotify(const Json::Value &params) {
+    if (!params.isArray() || params.size() < 9 || !params[4].isArray()) {
+        throw std::runtime_error("Malformed mining.notify");
+    }
+    StratumJob job;
+    job.jobId = params[0].asString();
+    job.prevHash = params[1].asString();
+    job.coinbase1 = params[2].asString();
+    job.coinbase2 = params[3].asString();
+    for (const Json::Value &branch : params[4]) {
+        job.merkleBranch.push_back(branch.asString());
+    }
+    job.version = params[5].asString();
+    job.bits = params[6].asString();
+    job.time = params[7].asString();
+    job.clean = params[8].asBool();
+    return job;
+}
+
+// Assembles the block header for a job: coinbase = coinb1 + extranonce1 +
+// extranonce2 + coinb2, hashed up the merkle branch to the root. Version,
+// bits and time arrive as big-endian hex and the previous hash with each
+// 32-bit word byte-swapped; the header stores all of them little-endian.
+MiningJob buildJob(const StratumJob &job, const std::string &extranonce1, const std::string &extranonce2) {
+    std::vector<uint8_t> coinbase = parseHex(job.coinbase1 + extranonce1 + extranonce2 + job.coinbase2);
+    std::array<uint8_t, 32> root = sha256d(coinbase.data(), coinbase.size());
+    for (const std::string &branch : job.merkleBranch) {
+        std::vector<uint8_t> pair(root.begin(), root.end());
+        std::vector<uint8_t> sibling = parseHex(branch);
+        if (sibling.size() != 32) {
+            throw std::runtime_error("Merkle branch entries are 32 bytes: " + branch);
+        }
+        pair.insert(pair.end(), sibling.begin(), sibling.end());
+        root = sha256d(pair.data(), pair.size());
+    }
+    std::vector<uint8_t> prevHash = parseHex(job.prevHash);
+    if (prevHash.size() != 32) {
+        throw std::runtime_error("Previous hash is 32 bytes: " + job.prevHash);
+    }
+
+    uint8_t header[80] = {};
+    auto putWord = [&](size_t offset, uint32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            header[offset + i] = uint8_t(value >> (8 * i));
+        }
+    };
+    putWord(0, parseWord(job.version));
+    for (int word = 0; word < 8; ++word) {
+        for (int i = 0; i < 4; ++i) {
+            header[4 + 4 * word + i] = prevHash[4 * word + 3 - i];
+        }
+    }
+    std::memcpy(header + 36, root.data(), 32);
+    putWord(68, parseWord(job.time));
+    putWord(72, parseWord(job.bits));
+    return makeJob(header);
+}
+
+// Stratum v1 connection: newline-delimited JSON over a non-blocking socket,
+// driven by epoll together with extra descriptors (the miner's events and
+// its stop descriptor), so a found share or a shutdown wakes the loop as
+// promptly as pool traffic does.
+class StratumClient {
+public:
+    StratumClient(const std::string &host, const std::string &port, const std::vector<int> &wakeFds,
+                  std::chrono::milliseconds timeout = std::chrono::seconds(10)) {
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *addresses = nullptr;
+        int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+        if (status != 0) {
+            throw std::runtime_error("Could not resolve " + host + ": " + gai_strerror(status));
+        }
+        for (addrinfo *address = addresses; address && fd < 0; address = address->ai_next) {
+            fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            if (connect(fd, address->ai_addr, address->ai_addrlen) != 0 && errno != EINPROGRESS) {
+                close(fd);
+                fd = -1;
+                continue;
+            }
+            pollfd pending = {fd, POLLOUT, 0};
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (::poll(&pending, 1, static_cast<int>(timeout.count())) != 1 ||
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+        if (fd < 0) {
+            throw std::runtime_error("Could not connect to " + host + ":" + port);
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // submits are tiny and latency-bound
+
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) {
+            close(fd);
+            throw std::runtime_error(std::string("epoll_create1: ") + std::strerror(errno));
+        }
+        watch(EPOLL_CTL_ADD, fd, EPOLLIN);
+        for (int wakeFd : wakeFds) {
+            watch(EPOLL_CTL_ADD, wakeFd, EPOLLIN);
+        }
+    }
+
+    ~StratumClient() {
+        close(epollFd);
+        close(fd);
+    }
+
+    void send(const Json::Value &message) {
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        outbox += Json::writeString(builder, message) + "\n";
+        flush();
+    }
+
+    // Stops waking poll() for a descriptor that will stay readable.
+    void unwatch(int wakeFd) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, wakeFd, nullptr);
+    }
+
+    // Waits up to timeoutMs for pool traffic or a wake-up and hands every
+    // complete message to onMessage. Returns false once the pool hangs up.
+    bool poll(int timeoutMs, const std::function<void(const Json::Value &)> &onMessage) {
+        epoll_event events[4];
+        int ready = epoll_wait(epollFd, events, 4, timeoutMs);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                return true;
+            }
+            throw std::runtime_error(std::string("epoll_wait: ") + std::strerror(errno));
+        }
+        for (int i = 0; i < ready; ++i) {
+            if (events[i].data.fd != fd) {
+                continue; // wake-up descriptors are drained by their owners
+            }
+            if (events[i].events & EPOLLOUT) {
+                flush();
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                if (!receive(onMessage)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    static constexpr size_t kMaxLine = 1 << 20;
+
+    int fd = -1;
+    int epollFd = -1;
+    std::string inbox;
+    std::string outbox;
+    bool wantWrite = false;
+
+    void watch(int operation, int descriptor, uint32_t events) {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = descriptor;
+        if (epoll_ctl(epollFd, operation, descriptor, &event) != 0) {
+            throw std::runtime_error(std::string("epoll_ctl: ") + std::strerror(errno));
+        }
+    }
+
+    void flush() {
+        while (!outbox.empty()) {
+            ssize_t sent = ::send(fd, outbox.data(), outbox.size(), MSG_NOSIGNAL);
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (sent < 0) {
+                throw std::runtime_error(std::string("Pool connection lost: ") + std::strerror(errno));
+            }
+            outbox.erase(0, static_cast<size_t>(sent));
+        }
+        bool pending = !outbox.empty();
+        if (pending != wantWrite) {
+            wantWrite = pending;
+            watch(EPOLL_CTL_MOD, fd, pending ? EPOLLIN | EPOLLOUT : EPOLLIN);
+        }
+    }
+
+    // Reads what is available and hands on every complete line, including
+    // the ones that arrived together with the pool hanging up. Returns false
+    // once the connection is gone.
+    bool receive(const std::function<void(const Json::Value &)> &onMessage) {
+        char buffer[16384];
+        bool open = true;
+        while (open) {
+            ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received == 0) {
+                open = false;
+            } else if (received < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                open = errno == EINTR;
+            } else {
+                inbox.append(buffer, static_cast<size_t>(received));
+            }
+        }
+
+        Json::CharReaderBuilder builder;
+        std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+        size_t start = 0;
+        for (size_t end; (end = inbox.find('\n', start)) != std::string::npos; start = end + 1) {
+            if (end == start) {
+                continue;
+            }
+            Json::Value message;
+            std::string errors;
+            if (!reader->parse(inbox.data() + start, inbox.data() + end, &message, &errors)) {
+                spdlog::warn("Ignoring malformed pool message: {}", errors);
+                continue;
+            }
+            onMessage(message);
+        }
+        inbox.erase(0, start);
+        if (inbox.size() > kMaxLine) {
+            throw std::runtime_error("Pool sent an over-long line");
+        }
+        return open;
+    }
+};
+
 class BitcoinMiner {
 public:
-    BitcoinMiner(const std::string &address);
+    BitcoinMiner(const std::string &address, int threads = 0, const std::string &headerHex = "",
+                 const std::string &backend = "", const std::string &pool = "", const std::string &password = "x",
+                 const std::string &statsFile = "", const std::string &recordFile = "");
+    ~BitcoinMiner();
     void startMining();
+    void requestStop();
     void logMessage(const std::string &msg);
     void handleSignal(int signal);
     void registerSignals();
 
+    // Drives the Stratum path with no pool, for --bench. Every request goes
+    // to sink, and a non-null return is handled as the pool's reply. Each
+    // job is hashed over nonces [0, window) only.
+    using RequestSink = std::function<Json::Value(const Json::Value &)>;
+    void startReplay(RequestSink sink, uint64_t window);
+    // Handles message as if the pool had sent it. If that publishes work,
+    // returns once every thread has finished the window, submitting shares
+    // as they are found.
+    void replay(const Json::Value &message);
+    void stopReplay();
+    EngineStats engineStats() const;
+
 private:
+    // How long shutdown waits for the pool to answer outstanding shares.
+    static constexpr std::chrono::milliseconds kFlushTimeout{2000};
+    static constexpr std::chrono::seconds kLogInterval{10};
+
     std::string address;
-    bool shutdownFlag;
+    std::atomic<bool> shutdownFlag;
+    int threads;
+    hashing::Path backend;
+    std::string poolHost; // empty: mine the local header
+    std::string poolPort;
+    std::string password;
+    std::string statsFile; // Prometheus text file, rewritten every second
+    std::ofstream recording; // pool jobs, one JSON message per line, for --bench --replay
+    int signalFd = -1;
+    int stopFd = -1;                         // readable once a stop is requested
+    std::atomic<int64_t> stopRequestedNs{0}; // steady clock
+    MinerEvents events;
+    std::unique_ptr<HashingEngine> engine;
+    std::unique_ptr<StratumClient> pool;
+    RequestSink requestSink;          // replaces pool while replaying
+    std::deque<Json::Value> replies;  // from requestSink, not yet handled
+    uint64_t nonceWindow = uint64_t(1) << 32;
+    Telemetry telemetry;
+    std::chrono::steady_clock::time_point nextSample;
+    std::chrono::steady_clock::time_point nextLog;
     void runMiner();
+    void startEngine();
     void connectToPool();
+    void openSession();
+    void handleReplies();
     void worker();
+    void waitForStop();
     void logError(const std::string &msg);
     void logException(const std::exception &e);
+    void mineSolo();
+    void minePool();
+    void stopHashing();
+    void idleHashing();
+    void updateTelemetry(bool force = false);
+    void flushShares();
+    void handlePoolMessage(const Json::Value &message);
+    void sendRequest(const std::string &method, const Json::Value &params);
+    void publishPoolJob();
+    void submitShare(const Share &share);
+    void record(const Json::Value &message);
+    size_t pendingSubmits() const;
+
+    // What a share must quote back to the pool.
+    struct Submission {
+        std::string jobId;
+        std::string extranonce2;
+        std::string time;
+    };
 
-    // Context information as needed
+    // Context information, owned by the thread running worker(); the hashing
+    // threads only ever see the published MiningJob.
     struct Context {
         std::string prevHash;
         std::string jobId;
-        // Add other context variables as needed
+        MiningJob job;            // header being mined
+        uint64_t generation = 0;  // engine generation hashing job
+
+        // Stratum session.
+        StratumJob stratumJob;
+        bool haveJob = false;
+        std::string extranonce1;
+        size_t extranonce2Size = 4;
+        uint64_t extranonce2 = 0;
+        double difficulty = 1;
+        std::map<uint64_t, Submission> submissions; // recent generations only
+        std::map<int, std::string> requests;        // id -> method, until answered
+        int nextId = 1;
+        ShareCounts shares;
     } ctx;
 };
 
-BitcoinMiner::BitcoinMiner(const std::string &address) : address(address), shutdownFlag(false) {
+// Without --pool the miner works on a fixed header; the default is the
+// genesis block's.
+const char *kGenesisHeader =
+    "0100000000000000000000000000000000000000000000000000000000000000000000003ba3edfd7a7b12b27ac72c3e67768f617fc81bc3"
+    "888a51323a9fb8aa4b1e5e4a29ab5f49ffff001d1dac2b7c";
+
+BitcoinMiner::BitcoinMiner(const std::string &address, int threads, const std::string &headerHex,
+                           const std::string &backend, const std::string &pool, const std::string &password,
+                           const std::string &statsFile, const std::string &recordFile)
+    : address(address), shutdownFlag(false),
+      threads(threads > 0 ? threads : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()))),
+      backend(hashing::select(backend)), password(password), statsFile(statsFile) {
     spdlog::info("Bitcoin Wallet: {}", address);
+    spdlog::info("Hashing backend: {}", this->backend.name);
+    if (!pool.empty()) {
+        size_t colon = pool.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == pool.size()) {
+            throw std::invalid_argument("Expected --pool host:port, got " + pool);
+        }
+        poolHost = pool.substr(0, colon);
+        poolPort = pool.substr(colon + 1);
+    }
+    ctx.job = makeJob(headerHex.empty() ? kGenesisHeader : headerHex);
+    if (!recordFile.empty()) {
+        recording.open(recordFile, std::ios::app);
+        if (!recording) {
+            throw std::runtime_error("Could not open " + recordFile);
+        }
+    }
+    stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stopFd < 0) {
+        throw std::runtime_error(std::string("eventfd: ") + std::strerror(errno));
+    }
+}
+
+BitcoinMiner::~BitcoinMiner() {
+    if (signalFd >= 0) {
+        close(signalFd);
+    }
+    close(stopFd);
 }
 
+// Runs until SIGINT/SIGTERM or requestStop(). This thread only waits for
+// the stop; the worker thread talks to the pool and the engine's threads
+// hash.
 void BitcoinMiner::startMining() {
-    registerSignals();
     try {
+        registerSignals();
+        startEngine();
+        nextLog = std::chrono::steady_clock::now() + kLogInterval;
         std::thread workerThread(&BitcoinMiner::worker, this);
+        waitForStop();
         workerThread.join();
+        spdlog::info("Shut down {:.2f} ms after the stop request", (steadyNanos() - stopRequestedNs.load()) / 1e6);
     } catch (const std::exception &e) {
         logException(e);
     }
 }
 
+void BitcoinMiner::startEngine() {
+    engine = std::make_unique<HashingEngine>(
+        threads, backend.kernel, [this](const Share &share) { events.share(share); },
+        [this](uint64_t generation) { events.exhausted(generation); });
+}
+
+// Stops by making stopFd readable: every wait in the miner includes it, so
+// the worker wakes at once, and the hashing threads see the engine's stop
+// flag within one batch.
+void BitcoinMiner::requestStop() {
+    int64_t unset = 0;
+    stopRequestedNs.compare_exchange_strong(unset, steadyNanos());
+    shutdownFlag = true;
+    uint64_t one = 1;
+    ssize_t written = write(stopFd, &one, sizeof(one));
+    (void)written; // already readable if the counter is full
+}
+
+void BitcoinMiner::handleSignal(int signal) {
+    spdlog::info("Received {}; terminating miner, please wait..", strsignal(signal));
+    requestStop();
+}
+
+// Signals are taken synchronously through a signalfd instead of a handler,
+// so stopping runs on an ordinary thread and may log, lock and join. Must
+// run before any other thread starts, as threads inherit the blocked mask.
 void BitcoinMiner::registerSignals() {
-    signal(SIGINT, [](int signal) {
-        // Handle cleanup on exit
-        spdlog::info("Terminating Miner, Please Wait..");
-        exit(0);
-    });
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    int status = pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    if (status != 0) {
+        throw std::runtime_error(std::string("pthread_sigmask: ") + std::strerror(status));
+    }
+    signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd < 0) {
+        throw std::runtime_error(std::string("signalfd: ") + std::strerror(errno));
+    }
 }
 
-void BitcoinMiner::worker() {
-    // Simulate connection to mining pool
-    connectToPool();
+void BitcoinMiner::waitForStop() {
+    pollfd fds[2] = {{signalFd, POLLIN, 0}, {stopFd, POLLIN, 0}};
+    while (!shutdownFlag) {
+        if (::poll(fds, 2, -1) < 0 && errno != EINTR) {
+            logError(std::string("poll: ") + std::strerror(errno));
+            requestStop();
+        }
+        signalfd_siginfo info;
+        if (fds[0].revents & POLLIN && read(signalFd, &info, sizeof(info)) == sizeof(info)) {
+            handleSignal(static_cast<int>(info.ssi_signo));
+        }
+    }
+}
 
+void BitcoinMiner::worker() {
     while (!shutdownFlag) {
         try {
+            connectToPool();
             runMiner();
-            std::this_thread::sleep_for(std::chrono::seconds(1)); // Simulate work delay
         } catch (const std::exception &e) {
             logException(e);
+            pool.reset();
+            idleHashing();
+            pollfd stop = {stopFd, POLLIN, 0};
+            ::poll(&stop, 1, 5000); // before reconnecting, unless stopping
         }
     }
+    stopHashing();
+    try {
+        flushShares();
+    } catch (const std::exception &e) {
+        logException(e);
+    }
+    updateTelemetry(true);
+}
+
+// Parks the hashing threads on an empty nonce range once the session is
+// gone, and drops the shares they found for it: no later session can
+// submit them.
+void BitcoinMiner::idleHashing() {
+    if (!engine) {
+        return;
+    }
+    ctx.haveJob = false;
+    ctx.submissions.clear();
+    engine->waitIdle(engine->publish(ctx.job, 0, 0));
+    std::vector<Share> shares;
+    std::vector<uint64_t> finished;
+    events.drain(shares, finished);
+    ctx.shares.discarded += shares.size();
 }
 
 void BitcoinMiner::connectToPool() {
-    // Simulate a connection to a mining pool (Placeholder for real implementation)
-    spdlog::info("Connecting to mining pool...");
-    // Use socket programming to connect to pool (e.g., solo.ckpool.org on port 3333)
-    // Handle connection and authorization
+    if (poolHost.empty()) {
+        spdlog::info("No pool given; mining the local header.");
+        return;
+    }
+    spdlog::info("Connecting to mining pool {}:{}...", poolHost, poolPort);
+    pool = std::make_unique<StratumClient>(poolHost, poolPort, std::vector<int>{events.descriptor(), stopFd});
+    openSession();
+}
+
+// Starts the Stratum session: subscribe, then authorize the wallet address as
+// the worker name. Replies arrive through handlePoolMessage.
+void BitcoinMiner::openSession() {
+    ctx.requests.clear();
+    ctx.submissions.clear();
+    ctx.haveJob = false;
+    ctx.extranonce1.clear();
+
+    Json::Value subscribe(Json::arrayValue);
+    subscribe.append("kickai-miner/1.0");
+    sendRequest("mining.subscribe", subscribe);
+    Json::Value authorize(Json::arrayValue);
+    authorize.append(address);
+    authorize.append(password);
+    sendRequest("mining.authorize", authorize);
 }
 
 void BitcoinMiner::runMiner() {
-    // Implement mining logic here
-    // Simulate generating a random nonce
-    std::random_device rd;
-    std::mt19937 mt(rd());
-    std::uniform_int_distribution<int> dist(0, 0xFFFFFFFF);
-    int nonce = dist(mt);
-
-    // Logging mining progress
-    std::ostringstream oss;
-    oss << "Mining with nonce: " << nonce;
-    logMessage(oss.str());
+    if (pool) {
+        minePool();
+    } else {
+        mineSolo();
+    }
+}
+
+// Hashes the local header until shutdown. When the nonce space runs out the
+// header time is rolled forward, which gives a fresh nonce space without
+// touching the midstate's inputs.
+void BitcoinMiner::mineSolo() {
+    ctx.generation = engine->publish(ctx.job);
+    spdlog::info("Mining with {} threads, time {}, bits {:08x}", threads, ctx.job.time(), ctx.job.bits());
+    std::vector<Share> shares;
+    std::vector<uint64_t> finished;
+    while (!shutdownFlag) {
+        events.wait(100, stopFd);
+        events.drain(shares, finished);
+        for (const Share &share : shares) {
+            spdlog::info("Block solved: nonce {} hash {}", share.nonce, displayHash(share.hash));
+        }
+        if (std::find(finished.begin(), finished.end(), ctx.generation) != finished.end()) {
+            uint8_t header[80];
+            std::memcpy(header, ctx.job.header, 80);
+            uint32_t time = ctx.job.time() + 1;
+            for (int i = 0; i < 4; ++i) {
+                header[68 + i] = uint8_t(time >> (8 * i));
+            }
+            ctx.job = makeJob(header);
+            ctx.generation = engine->publish(ctx.job);
+        }
+        updateTelemetry();
+    }
+}
+
+// Runs the pool session until it drops: pool messages, found shares and
+// exhausted slices are all handled on this thread.
+void BitcoinMiner::minePool() {
+    std::vector<Share> shares;
+    std::vector<uint64_t> finished;
+    while (!shutdownFlag) {
+        if (!pool->poll(100, [this](const Json::Value &message) { handlePoolMessage(message); })) {
+            throw std::runtime_error("Pool closed the connection");
+        }
+        events.drain(shares, finished);
+        for (const Share &share : shares) {
+            submitShare(share);
+        }
+        if (ctx.haveJob && std::find(finished.begin(), finished.end(), ctx.generation) != finished.end()) {
+            ++ctx.extranonce2; // a new coinbase gives a new nonce space
+            publishPoolJob();
+        }
+        updateTelemetry();
+    }
+}
+
+// Joins the hashing threads, which finish within one batch of the request.
+void BitcoinMiner::stopHashing() {
+    engine->stop();
+    spdlog::info("Hashing threads stopped {:.2f} ms after the stop request",
+                 (steadyNanos() - stopRequestedNs.load()) / 1e6);
+}
+
+// Samples the engine once a second (refreshing the stats file) and logs a
+// summary every kLogInterval; force does both now.
+void BitcoinMiner::updateTelemetry(bool force) {
+    auto now = std::chrono::steady_clock::now();
+    if (!force && now < nextSample) {
+        return;
+    }
+    nextSample = now + std::chrono::seconds(1);
+    telemetry.sample(engine->stats(), now);
+    if (!statsFile.empty()) {
+        try {
+            telemetry.writeFile(statsFile, ctx.shares);
+        } catch (const std::exception &e) {
+            logError(e.what());
+        }
+    }
+    if (force || now >= nextLog) {
+        nextLog = now + kLogInterval;
+        logMessage(telemetry.logLine(ctx.shares));
+    }
+}
+
+// Submits shares found before the threads stopped and waits, up to
+// kFlushTimeout, for the pool to answer every outstanding submit.
+void BitcoinMiner::flushShares() {
+    if (!pool) {
+        return;
+    }
+    std::vector<Share> shares;
+    std::vector<uint64_t> finished;
+    events.drain(shares, finished);
+    for (const Share &share : shares) {
+        submitShare(share);
+    }
+    pool->unwatch(stopFd);
+    auto deadline = std::chrono::steady_clock::now() + kFlushTimeout;
+    while (pendingSubmits() > 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0 || !pool->poll(static_cast<int>(left.count()), [this](const Json::Value &message) {
+                handlePoolMessage(message);
+            })) {
+            break;
+        }
+    }
+    if (pendingSubmits() > 0) {
+        spdlog::warn("{} shares unanswered at shutdown", pendingSubmits());
+    }
+}
+
+size_t BitcoinMiner::pendingSubmits() const {
+    return static_cast<size_t>(std::count_if(ctx.requests.begin(), ctx.requests.end(),
+                                             [](const std::pair<const int, std::string> &request) {
+                                                 return request.second == "mining.submit";
+                                             }));
+}
+
+void BitcoinMiner::sendRequest(const std::string &method, const Json::Value &params) {
+    Json::Value request;
+    request["id"] = ctx.nextId;
+    request["method"] = method;
+    request["params"] = params;
+    ctx.requests[ctx.nextId++] = method;
+    if (requestSink) {
+        Json::Value reply = requestSink(request);
+        if (!reply.isNull()) {
+            replies.push_back(reply);
+        }
+    } else {
+        pool->send(request);
+    }
+}
+
+void BitcoinMiner::handlePoolMessage(const Json::Value &message) {
+    const Json::Value &method = message["method"];
+    if (method.isString()) {
+        const Json::Value &params = message["params"];
+        if (method.asString() == "mining.notify") {
+            StratumJob job = parseNotify(params);
+            if (recording.is_open()) {
+                record(message);
+            }
+            if (job.clean) {
+                ctx.submissions.clear(); // shares for older jobs are stale now
+            }
+            ctx.stratumJob = job;
+            ctx.haveJob = true;
+            ctx.extranonce2 = 0;
+            publishPoolJob();
+        } else if (method.asString() == "mining.set_difficulty") {
+            if (params.isArray() && !params.empty() && params[0].isNumeric() && params[0].asDouble() > 0) {
+                ctx.difficulty = params[0].asDouble();
+                spdlog::info("Pool difficulty {}", ctx.difficulty);
+            }
+        } else {
+            spdlog::debug("Ignoring pool method {}", method.asString());
+        }
+        return;
+    }
+
+    // Our ids are ints; anything else (a string, null, out of range) is not
+    // an answer to one of our requests, and asInt() would throw on it.
+    const Json::Value &id = message["id"];
+    if (!id.isInt()) {
+        return;
+    }
+    auto request = ctx.requests.find(id.asInt());
+    if (request == ctx.requests.end()) {
+        return;
+    }
+    std::string requested = request->second;
+    ctx.requests.erase(request);
+    const Json::Value &result = message["result"];
+    const Json::Value &error = message["error"];
+    if (requested == "mining.subscribe") {
+        if (!result.isArray() || result.size() < 3) {
+            throw std::runtime_error("Pool rejected mining.subscribe");
+        }
+        ctx.extranonce1 = result[1].asString();
+        ctx.extranonce2Size = extranonce2Size(result[2]);
+        spdlog::info("Subscribed: extranonce1 {}, extranonce2 size {}", ctx.extranonce1, ctx.extranonce2Size);
+        if (recording.is_open()) {
+            Json::Value subscribed;
+            subscribed["extranonce1"] = ctx.extranonce1;
+            subscribed["extranonce2_size"] = static_cast<Json::UInt>(ctx.extranonce2Size);
+            record(subscribed);
+        }
+        publishPoolJob();
+    } else if (requested == "mining.authorize") {
+        if (!result.asBool()) {
+            throw std::runtime_error("Pool did not authorize worker " + address);
+        }
+        spdlog::info("Authorized as {}", address);
+    } else if (requested == "mining.submit") {
+        if (result.isBool() && result.asBool()) {
+            ++ctx.shares.accepted;
+        } else if (error.isArray() && !error.empty() && error[0].isInt() && error[0].asInt() == 21) {
+            ++ctx.shares.stale; // "job not found": the pool moved on first
+        } else {
+            ++ctx.shares.rejected;
+            spdlog::warn("Share rejected: {}", error.isArray() && error.size() > 1 ? error[1].asString() : "no reason");
+        }
+    }
+}
+
+// Builds the header for the current job and extranonce2 and hands it to the
+// hashing threads. Needs both a job and the subscription's extranonce1.
+void BitcoinMiner::publishPoolJob() {
+    if (!ctx.haveJob || ctx.extranonce1.empty()) {
+        return;
+    }
+    std::ostringstream extranonce2;
+    extranonce2 << std::hex << std::setfill('0') << std::setw(static_cast<int>(ctx.extranonce2Size * 2))
+                << ctx.extranonce2;
+    Submission submission = {ctx.stratumJob.jobId, extranonce2.str().substr(0, ctx.extranonce2Size * 2),
+                             ctx.stratumJob.time};
+
+    MiningJob job = buildJob(ctx.stratumJob, ctx.extranonce1, submission.extranonce2);
+    uint8_t target[32];
+    difficultyToTarget(ctx.difficulty, target);
+    setTarget(job, target);
+    ctx.job = job;
+    ctx.jobId = ctx.stratumJob.jobId;
+    ctx.prevHash = ctx.stratumJob.prevHash;
+    ctx.generation = engine->publish(job, 0, nonceWindow);
+    ctx.submissions[ctx.generation] = submission;
+    while (ctx.submissions.size() > 64) {
+        ctx.submissions.erase(ctx.submissions.begin());
+    }
+}
+
+void BitcoinMiner::submitShare(const Share &share) {
+    auto submission = ctx.submissions.find(share.generation);
+    if (submission == ctx.submissions.end()) {
+        ++ctx.shares.discarded; // its job is gone; the pool would only call it stale
+        return;
+    }
+    char nonce[9];
+    std::snprintf(nonce, sizeof(nonce), "%08x", share.nonce);
+    Json::Value params(Json::arrayValue);
+    params.append(address);
+    params.append(submission->second.jobId);
+    params.append(submission->second.extranonce2);
+    params.append(submission->second.time);
+    params.append(nonce);
+    sendRequest("mining.submit", params);
+}
+
+void BitcoinMiner::startReplay(RequestSink sink, uint64_t window) {
+    requestSink = std::move(sink);
+    nonceWindow = std::max<uint64_t>(1, std::min<uint64_t>(window, uint64_t(1) << 32));
+    startEngine();
+    openSession();
+    handleReplies();
+}
+
+void BitcoinMiner::replay(const Json::Value &message) {
+    uint64_t before = ctx.generation;
+    handlePoolMessage(message);
+    handleReplies();
+    uint64_t generation = ctx.generation;
+    if (generation == before) {
+        return;
+    }
+    // Every thread reports the end of its slice once.
+    std::vector<Share> shares;
+    std::vector<uint64_t> finished;
+    for (int done = 0; done < threads;) {
+        events.wait(100);
+        events.drain(shares, finished);
+        for (const Share &share : shares) {
+            submitShare(share);
+        }
+        handleReplies();
+        done += static_cast<int>(std::count(finished.begin(), finished.end(), generation));
+    }
+}
+
+void BitcoinMiner::stopReplay() {
+    engine->stop();
+}
 
-    // Simulate block solving
-    // This is where you would implement the actual algorithm for solving the block
+EngineStats BitcoinMiner::engineStats() const {
+    return engine->stats();
+}
+
+void BitcoinMiner::handleReplies() {
+    while (!replies.empty()) {
+        Json::Value reply = std::move(replies.front());
+        replies.pop_front();
+        handlePoolMessage(reply);
+    }
+}
+
+void BitcoinMiner::record(const Json::Value &message) {
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    recording << Json::writeString(builder, message) << std::endl;
 }
 
 void BitcoinMiner::logMessage(const std::string &msg) {
@@ -110,15 +2013,837 @@ void BitcoinMiner::logException(const std::exception &e) {
     spdlog::critical("Exception thrown: {}", e.what());
 }
 
+// A Stratum pool on a loopback socket, for --self-test. Each session answers
+// subscribe and authorize, sends one known job and checks the shares that
+// come back: the header is rebuilt from the prefix this job must produce
+// (worked out independently of buildJob) and the submitted nonce, and must
+// hash below the share target. After the first valid share of the first
+// session the pool drops the connection, so the second session only happens
+// if the miner reconnects.
+class MockPool {
+public:
+    static constexpr int kSessions = 2;
+
+    struct Report {
+        int sessions = 0;         // connections accepted
+        int validShares[kSessions] = {};
+        int badShares = 0;
+        std::string firstHash;    // of the first valid share, for the log
+        double reconnectMs = 0;   // from the drop to the next connection
+    };
+
+    explicit MockPool(double difficulty) : difficulty(difficulty) {
+        difficultyToTarget(difficulty, target);
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+            listen(listenFd, 1) != 0 || getsockname(listenFd, reinterpret_cast<sockaddr *>(&address), &length) != 0) {
+            int error = errno;
+            if (listenFd >= 0) {
+                close(listenFd);
+            }
+            throw std::runtime_error(std::string("Mock pool: ") + std::strerror(error));
+        }
+        port = ntohs(address.sin_port);
+        server = std::thread([this] { serve(); });
+    }
+
+    ~MockPool() {
+        stopping = true;
+        server.join();
+        close(listenFd);
+    }
+
+    MockPool(const MockPool &) = delete;
+    MockPool &operator=(const MockPool &) = delete;
+
+    std::string endpoint() const { return "127.0.0.1:" + std::to_string(port); }
+
+    // Waits until every session has seen a valid share; returns what
+    // happened either way.
+    Report wait(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait_for(lock, timeout, [this] { return report.validShares[kSessions - 1] > 0; });
+        return report;
+    }
+
+private:
+    static constexpr const char *kExtranonce1 = "08000002";
+    static constexpr const char *kTime = "65f1a2b0";
+    // version, previous hash, merkle root, time and bits for kExtranonce1
+    // and extranonce2 00000000.
+    static constexpr const char *kHeaderPrefix =
+        "0000002054a02827d7a8b75601275a160279a3c5768de4c1c4a702000000000000000000d50e57f9cb8cbc7b93be4acebe72e38e5b"
+        "1b4ee80db49f3bb165bb880232596eb0a2f165ffff001d";
+
+    double difficulty;
+    uint8_t target[32];
+    int listenFd = -1;
+    uint16_t port = 0;
+    std::atomic<bool> stopping{false};
+    std::mutex mutex;
+    std::condition_variable changed;
+    Report report;
+    std::thread server;
+
+    static Json::Value notify() {
+        Json::Value params(Json::arrayValue);
+        params.append("self-test");
+        params.append("2728a05456b7a8d7165a2701c5a37902c1e48d760002a7c40000000000000000");
+        params.append("01000000010000000000000000000000000000000000000000000000000000000000000000ffffffff2003a0860108");
+        params.append("ffffffff0100f2052a010000001976a914111111111111111111111111111111111111111188ac00000000");
+        Json::Value branch(Json::arrayValue);
+        branch.append("32e99352a174f607e824eb552ccb09513f65d56e363ad3967257ab9f00176a8b");
+        branch.append("8b46e2d1a7b5d5327b9567c99f4e96cc6f9c7e70fb53aeaf0696e77c39ea4fa3");
+        params.append(branch);
+        params.append("20000000");
+        params.append("1d00ffff");
+        params.append(kTime);
+        params.append(true);
+        Json::Value message;
+        message["id"] = Json::Value::null;
+        message["method"] = "mining.notify";
+        message["params"] = params;
+        return message;
+    }
+
+    static void send(int fd, const Json::Value &message) {
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        std::string line = Json::writeString(builder, message) + "\n";
+        for (size_t sent = 0; sent < line.size();) {
+            ssize_t n = ::send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return; // the miner hung up; its next session will tell
+            }
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    static Json::Value reply(const Json::Value &id, const Json::Value &result) {
+        Json::Value message;
+        message["id"] = id;
+        message["result"] = result;
+        message["error"] = Json::Value::null;
+        return message;
+    }
+
+    // Rebuilds the header of a mining.submit and checks it against the job
+    // and the share target.
+    bool validShare(const Json::Value &params, std::string &hash) const {
+        if (!params.isArray() || params.size() < 5 || params[1].asString() != "self-test" ||
+            params[2].asString() != "00000000" || params[3].asString() != kTime || params[4].asString().size() != 8) {
+            return false;
+        }
+        uint32_t nonce = static_cast<uint32_t>(std::stoul(params[4].asString(), nullptr, 16));
+        std::vector<uint8_t> header = parseHex(kHeaderPrefix);
+        for (int i = 0; i < 4; ++i) {
+            header.push_back(static_cast<uint8_t>(nonce >> (8 * i)));
+        }
+        std::array<uint8_t, 32> digest = sha256d(header.data(), header.size());
+        std::array<uint8_t, 32> display = digest;
+        std::reverse(display.begin(), display.end());
+        hash = toHex(display.data(), display.size());
+        for (int i = 31; i >= 0; --i) {
+            if (digest[i] != target[i]) {
+                return digest[i] < target[i];
+            }
+        }
+        return true;
+    }
+
+    void serve() {
+        std::chrono::steady_clock::time_point dropped;
+        for (int session = 0; session < kSessions && !stopping; ++session) {
+            pollfd listening = {listenFd, POLLIN, 0};
+            while (!stopping && ::poll(&listening, 1, 100) <= 0) {
+            }
+            int fd = stopping ? -1 : accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                report.sessions = session + 1;
+                if (session > 0) {
+                    report.reconnectMs =
+                        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - dropped).count();
+                }
+            }
+            bool drop = converse(fd, session);
+            if (drop) {
+                shutdown(fd, SHUT_RDWR);
+                dropped = std::chrono::steady_clock::now();
+            }
+            close(fd);
+        }
+    }
+
+    // Serves one session until the miner hangs up, the pool is stopped, or
+    // (in the first session) a valid share asks for the connection to drop.
+    bool converse(int fd, int session) {
+        Json::CharReaderBuilder builder;
+        std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+        std::string inbox;
+        char buffer[4096];
+        while (!stopping) {
+            pollfd readable = {fd, POLLIN, 0};
+            if (::poll(&readable, 1, 100) <= 0) {
+                continue;
+            }
+            ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+            if (received <= 0) {
+                return false;
+            }
+            inbox.append(buffer, static_cast<size_t>(received));
+            for (size_t end; (end = inbox.find('\n')) != std::string::npos; inbox.erase(0, end + 1)) {
+                Json::Value message;
+                if (!reader->parse(inbox.data(), inbox.data() + end, &message, nullptr)) {
+                    continue;
+                }
+                std::string method = message["method"].asString();
+                if (method == "mining.subscribe") {
+                    Json::Value subscription(Json::arrayValue), subscriptions(Json::arrayValue);
+                    subscription.append("mining.notify");
+                    subscription.append("1");
+                    subscriptions.append(subscription);
+                    Json::Value result(Json::arrayValue);
+                    result.append(subscriptions);
+                    result.append(kExtranonce1);
+                    result.append(4);
+                    send(fd, reply(message["id"], result));
+                    Json::Value setDifficulty, params(Json::arrayValue);
+                    params.append(difficulty);
+                    setDifficulty["id"] = Json::Value::null;
+                    setDifficulty["method"] = "mining.set_difficulty";
+                    setDifficulty["params"] = params;
+                    send(fd, setDifficulty);
+                    send(fd, notify());
+                } else if (method == "mining.authorize") {
+                    send(fd, reply(message["id"], true));
+                } else if (method == "mining.submit") {
+                    std::string hash;
+                    bool valid = validShare(message["params"], hash);
+                    send(fd, reply(message["id"], valid));
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!valid) {
+                        ++report.badShares;
+                        continue;
+                    }
+                    if (report.firstHash.empty()) {
+                        report.firstHash = hash;
+                    }
+                    ++report.validShares[session];
+                    changed.notify_all();
+                    if (session == 0) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+};
+
+// Checks hashing and the nonce search against mainnet headers, for every
+// backend available here:
+// - the plain SHA-256d, the midstate path and the target test must all
+//   agree with the known block hash;
+// - with an easy target, each backend must report the same hits, with the
+//   same hash words, as the scalar path over the mainnet headers and a set
+//   of pseudo-random ones (hits land in every SIMD lane and the tail);
+// - a threaded search over a window around the real nonce must find
+//   exactly that nonce;
+// - work published while the threads are busy must replace the old job;
+// - windowed hash rates and switch-latency buckets must come out exactly on
+//   a synthetic two-minute trace;
+// - against MockPool, a miner must submit shares whose headers hash below
+//   the share target, and reconnect and carry on after the pool drops it;
+// - busy threads must take up new work, and stop, within the deadline, both
+//   in the engine alone and in a whole miner stopped by SIGINT.
+int selfTest(int threads, std::chrono::milliseconds deadline) {
+    struct Known {
+        const char *name;
+        const char *header;
+        const char *hash;
+    };
+    const Known blocks[] = {
+        {"genesis", kGenesisHeader, "000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f"},
+        {"block 1",
+         "010000006fe28c0ab6f1b372c1a6a246ae63f74f931e8365e15a089c68d6190000000000982051fd1e4ba744bbbe680e1fee14677ba1a3"
+         "c3540bf7b1cdb606e857233e0e61bc6649ffff001d01e36299",
+         "00000000839a8e6886ab5951d76f411475428afc90947ee320161bbf18eb6048"},
+        {"block 125552",
+         "0100000081cd02ab7e569e8bcd9317e2fe99f2de44d49ab2b8851ba4a308000000000000e320b6c2fffc8d750423db8b1eb942ae710e95"
+         "1ed797f7affc8892b0f1fc122bc7f5d74df2b9441a42a14695",
+         "00000000000000001e8d6829a8a21adc5d38d0a473b144b6765798e61f98bd1d"},
+    };
+    const uint64_t kWindow = uint64_t(1) << 20;
+    int failures = 0;
+
+    std::vector<MiningJob> vectors;
+    for (const Known &block : blocks) {
+        MiningJob job = makeJob(block.header);
+        uint32_t nonce = job.header[76] | job.header[77] << 8 | job.header[78] << 16 | uint32_t(job.header[79]) << 24;
+
+        auto once = sha256::digest(job.header, 80);
+        auto twice = sha256::digest(once.data(), once.size());
+        std::reverse(twice.begin(), twice.end());
+        uint32_t state[8];
+        hashNonce(job, nonce, state);
+        bool hashOk = toHex(twice.data(), 32) == block.hash && displayHash(state) == block.hash &&
+                      meetsTarget(job, state);
+        std::cout << (hashOk ? "ok   " : "FAIL ") << block.name << ": hash " << displayHash(state) << std::endl;
+        failures += hashOk ? 0 : 1;
+        vectors.push_back(job);
+    }
+    std::mt19937 random(20240101);
+    for (int i = 0; i < 5; ++i) {
+        uint8_t header[80];
+        for (uint8_t &byte : header) {
+            byte = static_cast<uint8_t>(random());
+        }
+        vectors.push_back(makeJob(header));
+    }
+
+    // About one nonce in sixteen meets this target; the low bytes make the
+    // full comparison matter as well as the top word.
+    uint8_t easy[32];
+    std::memset(easy, 0xff, 32);
+    easy[31] = 0x0f;
+    easy[20] = 0x00;
+    hashing::Path scalar = {"scalar", hashing::scalarScan};
+    for (const hashing::Path &path : hashing::availablePaths()) {
+        size_t hits = 0;
+        bool same = true;
+        for (MiningJob job : vectors) {
+            setTarget(job, easy);
+            const uint32_t starts[] = {0, 1000003, 0xffffffffu - 4099};
+            for (uint32_t start : starts) {
+                uint64_t end = std::min<uint64_t>(uint64_t(start) + 4099, uint64_t(1) << 32);
+                for (uint64_t next = start; next < end && same;) {
+                    uint32_t count = static_cast<uint32_t>(end - next);
+                    uint32_t expectedNonce = 0, actualNonce = 0;
+                    uint32_t expected[8] = {}, actual[8] = {};
+                    bool expectedHit = scalar.kernel(job, static_cast<uint32_t>(next), count, expectedNonce, expected);
+                    bool actualHit = path.kernel(job, static_cast<uint32_t>(next), count, actualNonce, actual);
+                    same = expectedHit == actualHit &&
+                           (!expectedHit || (expectedNonce == actualNonce && std::memcmp(expected, actual, 32) == 0));
+                    if (!expectedHit) {
+                        break;
+                    }
+                    ++hits;
+                    next = uint64_t(expectedNonce) + 1;
+                }
+            }
+        }
+
+        // Each window search is published while the threads are still busy
+        // with a job that cannot succeed, so the window must replace it.
+        bool searchOk = true;
+        double hashes = 0, seconds = 0;
+        std::mutex sharesMutex;
+        std::vector<Share> shares;
+        HashingEngine engine(threads, path.kernel, [&](const Share &share) {
+            std::lock_guard<std::mutex> lock(sharesMutex);
+            shares.push_back(share);
+        });
+        for (size_t b = 0; b < sizeof(blocks) / sizeof(blocks[0]); ++b) {
+            const MiningJob &job = vectors[b];
+            uint32_t nonce = job.header[76] | job.header[77] << 8 | job.header[78] << 16 |
+                             uint32_t(job.header[79]) << 24;
+            MiningJob busy = job;
+            uint8_t impossible[32] = {};
+            setTarget(busy, impossible);
+            engine.publish(busy);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+            // Put the real nonce three quarters of the way into the window.
+            uint64_t begin = nonce >= kWindow * 3 / 4 ? nonce - kWindow * 3 / 4 : 0;
+            uint64_t end = std::min<uint64_t>(begin + kWindow, uint64_t(1) << 32);
+            uint64_t before = engine.totalHashes();
+            auto start = std::chrono::steady_clock::now();
+            uint64_t generation = engine.publish(job, begin, end);
+            engine.waitIdle(generation);
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            hashes += engine.totalHashes() - before;
+
+            std::lock_guard<std::mutex> lock(sharesMutex);
+            size_t found = 0;
+            for (const Share &share : shares) {
+                found += share.generation == generation && share.nonce == nonce ? 1 : 0;
+                searchOk = searchOk && share.generation == generation && share.nonce == nonce;
+            }
+            searchOk = searchOk && found == 1;
+            shares.clear();
+        }
+        engine.stop();
+
+        std::cout << (same && searchOk ? "ok   " : "FAIL ") << path.name << ": " << hits << " hits "
+                  << (same ? "match scalar" : "DIFFER from scalar") << ", mainnet search "
+                  << (searchOk ? "found every nonce" : "MISSED a nonce") << " at " << hashes / seconds / 1e6
+                  << " MH/s" << std::endl;
+        failures += same && searchOk ? 0 : 1;
+    }
+
+    {
+        // One minute at 5 MH/s, then one at 10 MH/s, sampled every second.
+        Telemetry telemetry;
+        EngineStats stats;
+        auto start = Telemetry::Clock::time_point();
+        for (int second = 0; second <= 120; ++second) {
+            telemetry.sample(stats, start + std::chrono::seconds(second));
+            stats.hashes += second < 60 ? 5000000 : 10000000;
+        }
+        stats.switchHistogram[switchBucket(1000)] += 98;
+        stats.switchHistogram[switchBucket(1001)] += 1;
+        stats.switchHistogram[switchBucket(5000000000)] += 1;
+        telemetry.sample(stats, start + std::chrono::seconds(121));
+        auto near = [](double actual, double expected) { return std::abs(actual - expected) < 1; };
+        bool ok = near(telemetry.rate(std::chrono::seconds(1)), 10e6) &&
+                  near(telemetry.rate(std::chrono::minutes(1)), 10e6) &&
+                  near(telemetry.rate(std::chrono::minutes(15)), (60 * 5e6 + 61 * 10e6) / 121) &&
+                  telemetry.switchQuantileMicros(0.5) == 1 && telemetry.switchQuantileMicros(0.99) == 2 &&
+                  telemetry.switchQuantileMicros(1) == UINT64_MAX;
+        std::cout << (ok ? "ok   " : "FAIL ") << "telemetry: " << telemetry.logLine(ShareCounts()) << std::endl;
+        failures += ok ? 0 : 1;
+    }
+
+    // Scalar makes the longest batches, so it bounds the stop latency.
+    auto elapsedMs = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    {
+        HashingEngine engine(threads, hashing::scalarScan, [](const Share &) {});
+        MiningJob busy = vectors[0];
+        uint8_t impossible[32] = {};
+        setTarget(busy, impossible);
+        for (int i = 0; i < 5; ++i) {
+            engine.publish(busy, uint64_t(i) << 28);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        auto start = std::chrono::steady_clock::now();
+        engine.stop();
+        double stopMs = elapsedMs(start);
+        double switchMs = engine.stats().maxSwitchNs / 1e6;
+        bool ok = stopMs <= deadline.count() && switchMs <= deadline.count();
+        std::cout << (ok ? "ok   " : "FAIL ") << "engine: " << threads << " threads switched jobs within " << switchMs
+                  << " ms and stopped in " << stopMs << " ms (deadline " << deadline.count() << " ms)" << std::endl;
+        failures += ok ? 0 : 1;
+    }
+    {
+        // About one hash in 2^16 makes a share, so shares come at once.
+        MockPool pool(1.0 / 65536);
+        BitcoinMiner miner("self-test", threads, "", "", pool.endpoint());
+        std::thread mining([&] { miner.startMining(); });
+        MockPool::Report report = pool.wait(std::chrono::seconds(20));
+        miner.requestStop();
+        mining.join();
+        bool ok = report.sessions == MockPool::kSessions && report.validShares[0] > 0 &&
+                  report.validShares[1] > 0 && report.badShares == 0;
+        std::cout << (ok ? "ok   " : "FAIL ") << "pool: " << report.validShares[0] << " + " << report.validShares[1]
+                  << " valid and " << report.badShares << " bad shares over " << report.sessions
+                  << " sessions, reconnected " << report.reconnectMs << " ms after the drop, first share hash "
+                  << report.firstHash << std::endl;
+        failures += ok ? 0 : 1;
+    }
+    {
+        // Block the signal here too, so it can only reach the miner's signalfd.
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        BitcoinMiner miner("self-test", threads, "", "scalar");
+        std::thread mining([&] { miner.startMining(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        auto start = std::chrono::steady_clock::now();
+        kill(getpid(), SIGINT);
+        mining.join();
+        double stopMs = elapsedMs(start);
+        bool ok = stopMs <= deadline.count();
+        std::cout << (ok ? "ok   " : "FAIL ") << "miner: SIGINT to exit in " << stopMs << " ms (deadline "
+                  << deadline.count() << " ms)" << std::endl;
+        failures += ok ? 0 : 1;
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Reports single-thread hashes/sec for every backend available here, on a
+// target no hash can meet so every nonce is hashed.
+int benchBackends() {
+    MiningJob job = makeJob(kGenesisHeader);
+    uint8_t impossible[32] = {};
+    setTarget(job, impossible);
+    const uint32_t nonces = uint32_t(1) << 22;
+    for (const hashing::Path &path : hashing::availablePaths()) {
+        uint32_t nonce;
+        uint32_t state[8];
+        path.kernel(job, 0, nonces / 16, nonce, state); // warm-up
+        auto start = std::chrono::steady_clock::now();
+        path.kernel(job, 0, nonces, nonce, state);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << path.name << ": " << nonces / seconds / 1e6 << " MH/s" << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+struct BenchOptions {
+    uint64_t seed = 1;
+    std::string replayFile; // recorded with --record; empty: synthetic jobs
+    size_t jobs = 16;       // synthetic jobs, or a cap on replayed ones (0: all)
+    uint64_t noncesPerJob = uint64_t(1) << 22;
+    double difficulty = 1.0 / 4096; // about four shares per 2^22 nonces
+    int maxThreads = 0;             // 0: all cores
+    std::string backend;
+};
+
+struct BenchJobs {
+    std::vector<Json::Value> notifications; // mining.notify messages
+    std::string extranonce1;
+    size_t extranonce2Size = 4;
+};
+
+std::string randomHex(std::mt19937_64 &random, size_t bytes) {
+    std::vector<uint8_t> data(bytes);
+    for (uint8_t &byte : data) {
+        byte = static_cast<uint8_t>(random());
+    }
+    return toHex(data.data(), data.size());
+}
+
+Json::Value notifyMessage(const StratumJob &job) {
+    Json::Value params(Json::arrayValue);
+    params.append(job.jobId);
+    params.append(job.prevHash);
+    params.append(job.coinbase1);
+    params.append(job.coinbase2);
+    Json::Value branch(Json::arrayValue);
+    for (const std::string &hash : job.merkleBranch) {
+        branch.append(hash);
+    }
+    params.append(branch);
+    params.append(job.version);
+    params.append(job.bits);
+    params.append(job.time);
+    params.append(job.clean);
+    Json::Value message;
+    message["id"] = Json::Value::null;
+    message["method"] = "mining.notify";
+    message["params"] = params;
+    return message;
+}
+
+// Jobs shaped like a pool's, drawn only from the seed.
+BenchJobs syntheticJobs(uint64_t seed, size_t count) {
+    std::mt19937_64 random(seed);
+    BenchJobs bench;
+    bench.extranonce1 = randomHex(random, 4);
+    for (size_t i = 0; i < count; ++i) {
+        StratumJob job;
+        job.jobId = std::to_string(i);
+        job.prevHash = randomHex(random, 32);
+        job.coinbase1 = randomHex(random, 40 + random() % 64);
+        job.coinbase2 = randomHex(random, 40 + random() % 64);
+        for (size_t b = random() % 12; b > 0; --b) {
+            job.merkleBranch.push_back(randomHex(random, 32));
+        }
+        job.version = "20000000";
+        job.bits = "1d00ffff";
+        char time[9];
+        std::snprintf(time, sizeof(time), "%08x", 1700000000u + static_cast<uint32_t>(i) * 30);
+        job.time = time;
+        job.clean = true;
+        bench.notifications.push_back(notifyMessage(job));
+    }
+    return bench;
+}
+
+// Reads a --record file: mining.notify messages and the subscription's
+// extranonce1. The recorded difficulty is not used; the benchmark sets its
+// own so that shares turn up at a useful rate.
+BenchJobs recordedJobs(const std::string &path, size_t limit) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Could not open " + path);
+    }
+    BenchJobs bench;
+    bench.extranonce1 = "00000000";
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    std::string line;
+    while (std::getline(in, line) && (limit == 0 || bench.notifications.size() < limit)) {
+        Json::Value message;
+        std::string errors;
+        if (line.empty() || !reader->parse(line.data(), line.data() + line.size(), &message, &errors)) {
+            continue;
+        }
+        if (message["extranonce1"].isString()) {
+            bench.extranonce1 = message["extranonce1"].asString();
+            bench.extranonce2Size = extranonce2Size(message["extranonce2_size"]);
+        } else if (message["method"].asString() == "mining.notify") {
+            parseNotify(message["params"]); // throws on a malformed job
+            bench.notifications.push_back(message);
+        }
+    }
+    if (bench.notifications.empty()) {
+        throw std::runtime_error("No mining.notify messages in " + path);
+    }
+    return bench;
+}
+
+Json::Value switchSummary(const EngineStats &before, const EngineStats &after) {
+    std::array<uint64_t, kSwitchBuckets> histogram;
+    for (size_t b = 0; b < kSwitchBuckets; ++b) {
+        histogram[b] = after.switchHistogram[b] - before.switchHistogram[b];
+    }
+    uint64_t switches = after.switches - before.switches;
+    auto bound = [](uint64_t micros) {
+        return micros == UINT64_MAX ? Json::Value("inf") : Json::Value(static_cast<Json::UInt64>(micros));
+    };
+    Json::Value summary;
+    summary["count"] = static_cast<Json::UInt64>(switches);
+    summary["mean_us"] = switches ? (after.switchNs - before.switchNs) / 1e3 / switches : 0.0;
+    summary["p50_le_us"] = bound(histogramQuantileMicros(histogram, 0.5));
+    summary["p99_le_us"] = bound(histogramQuantileMicros(histogram, 0.99));
+    return summary;
+}
+
+// Replays every job through a miner's pool path, as if a pool had sent it:
+// handlePoolMessage parses the notify, publishPoolJob builds the coinbase,
+// merkle root, header and target and publishes them, and each share goes
+// out through submitShare to a sink that stands in for the pool and accepts
+// it. Each job gets a fixed nonce window. This runs once per thread count
+// from 1 to the maximum, and the results are printed as JSON.
+//
+// The jobs, windows and therefore the shares submitted depend only on the
+// seed or the replay file, so "shares" and "share_digest" must match between
+// runs and across thread counts; the timings are what to compare between
+// commits. Job-switch latency is measured both for idle threads (the
+// replayed jobs) and, on a bare engine, for busy ones (work replaced
+// mid-window).
+int benchReplay(const BenchOptions &options) {
+    if (!(options.difficulty > 0)) {
+        throw std::invalid_argument("--difficulty must be positive");
+    }
+    BenchJobs bench = options.replayFile.empty() ? syntheticJobs(options.seed, options.jobs)
+                                                 : recordedJobs(options.replayFile, options.jobs);
+    hashing::Path path = hashing::select(options.backend);
+    int maxThreads = options.maxThreads > 0 ? options.maxThreads
+                                            : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    const std::vector<Json::Value> &jobs = bench.notifications;
+    const std::string extranonce2(bench.extranonce2Size * 2, '0');
+    Json::Value setDifficulty;
+    setDifficulty["id"] = Json::Value::null;
+    setDifficulty["method"] = "mining.set_difficulty";
+    setDifficulty["params"].append(options.difficulty);
+    spdlog::set_level(spdlog::level::warn); // keep the miner's session log out of the JSON
+
+    Json::Value report;
+    report["seed"] = static_cast<Json::UInt64>(options.seed);
+    report["source"] = options.replayFile.empty() ? "synthetic" : options.replayFile;
+    report["backend"] = path.name;
+    report["difficulty"] = options.difficulty;
+    report["jobs"] = static_cast<Json::UInt64>(jobs.size());
+    report["nonces_per_job"] = static_cast<Json::UInt64>(options.noncesPerJob);
+    report["runs"] = Json::Value(Json::arrayValue);
+
+    bool consistent = true;
+    double baseRate = 0;
+    for (int threads = 1; threads <= maxThreads; ++threads) {
+        // The sink runs on the thread calling replay(), so it needs no lock.
+        size_t current = 0;
+        std::vector<std::pair<size_t, uint32_t>> found; // (job index, nonce)
+        std::vector<int64_t> firstSubmitNs(jobs.size(), 0);
+        auto pool = [&](const Json::Value &request) {
+            Json::Value reply;
+            reply["id"] = request["id"];
+            reply["error"] = Json::Value::null;
+            reply["result"] = true;
+            const std::string method = request["method"].asString();
+            if (method == "mining.subscribe") {
+                Json::Value result(Json::arrayValue);
+                result.append(Json::Value(Json::arrayValue));
+                result.append(bench.extranonce1);
+                result.append(static_cast<Json::UInt>(bench.extranonce2Size));
+                reply["result"] = result;
+            } else if (method == "mining.submit") {
+                const Json::Value &params = request["params"];
+                if (params[2].asString() != extranonce2) {
+                    reply["result"] = false; // the window never reaches a second extranonce2
+                    return reply;
+                }
+                found.emplace_back(current, static_cast<uint32_t>(std::stoul(params[4].asString(), nullptr, 16)));
+                if (firstSubmitNs[current] == 0) {
+                    firstSubmitNs[current] = steadyNanos();
+                }
+            }
+            return reply;
+        };
+
+        BitcoinMiner miner("bench", threads, "", path.name);
+        miner.startReplay(pool, options.noncesPerJob);
+        miner.replay(setDifficulty);
+        EngineStats before = miner.engineStats();
+        std::vector<double> firstSubmitMs;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            current = i;
+            int64_t received = steadyNanos();
+            miner.replay(jobs[i]);
+            if (firstSubmitNs[i] != 0) {
+                firstSubmitMs.push_back((firstSubmitNs[i] - received) / 1e6);
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        EngineStats replayed = miner.engineStats();
+        miner.stopReplay();
+
+        // Busy switches: replace work that never finishes every 10 ms.
+        HashingEngine engine(threads, path.kernel, [](const Share &) {});
+        MiningJob busy = buildJob(parseNotify(jobs[0]["params"]), bench.extranonce1, extranonce2);
+        uint8_t impossible[32] = {};
+        setTarget(busy, impossible);
+        engine.publish(busy);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        EngineStats busyBefore = engine.stats();
+        for (int i = 0; i < 16; ++i) {
+            engine.publish(busy, uint64_t(i) << 24);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        EngineStats busyAfter = engine.stats();
+        engine.stop();
+
+        std::sort(found.begin(), found.end());
+        std::vector<uint8_t> serialized;
+        for (const auto &share : found) {
+            for (int i = 0; i < 4; ++i) {
+                serialized.push_back(uint8_t(share.first >> (8 * i)));
+            }
+            for (int i = 0; i < 4; ++i) {
+                serialized.push_back(uint8_t(share.second >> (8 * i)));
+            }
+        }
+        auto digest = sha256::digest(serialized.data(), serialized.size());
+        std::sort(firstSubmitMs.begin(), firstSubmitMs.end());
+
+        double rate = (replayed.hashes - before.hashes) / seconds;
+        baseRate = threads == 1 ? rate : baseRate;
+        Json::Value run;
+        run["threads"] = threads;
+        run["hashes"] = static_cast<Json::UInt64>(replayed.hashes - before.hashes);
+        run["seconds"] = seconds;
+        run["hashes_per_second"] = rate;
+        run["speedup"] = rate / baseRate;
+        run["efficiency"] = rate / baseRate / threads;
+        run["shares"] = static_cast<Json::UInt64>(found.size());
+        run["share_digest"] = toHex(digest.data(), 16);
+        // From the notify reaching the miner to its first share reaching the
+        // sink.
+        Json::Value firstSubmit;
+        firstSubmit["jobs_with_share"] = static_cast<Json::UInt64>(firstSubmitMs.size());
+        if (!firstSubmitMs.empty()) {
+            double sum = 0;
+            for (double ms : firstSubmitMs) {
+                sum += ms;
+            }
+            firstSubmit["mean_ms"] = sum / firstSubmitMs.size();
+            firstSubmit["p50_ms"] = firstSubmitMs[firstSubmitMs.size() / 2];
+            firstSubmit["max_ms"] = firstSubmitMs.back();
+        }
+        run["time_to_first_submit"] = firstSubmit;
+        run["job_switch"]["idle"] = switchSummary(before, replayed);
+        run["job_switch"]["busy"] = switchSummary(busyBefore, busyAfter);
+
+        Json::Value &runs = report["runs"];
+        if (!runs.empty() && (runs[0]["shares"] != run["shares"] || runs[0]["share_digest"] != run["share_digest"])) {
+            consistent = false;
+        }
+        runs.append(run);
+    }
+    report["consistent"] = consistent;
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "  ";
+    builder["precision"] = 6;
+    std::cout << Json::writeString(builder, report) << std::endl;
+    return consistent ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, char *argv[]) {
     try {
-        if (argc != 2) {
-            std::cerr << "Usage: " << argv[0] << " <BTC_ADDRESS>" << std::endl;
+        if (argc < 2) {
+            std::cerr << "Usage: " << argv[0] << " <BTC_ADDRESS> [--threads N] [--header HEX] [--backend NAME]"
+                      << " [--pool HOST:PORT] [--password PASS] [--stats-file PATH] [--record PATH]" << std::endl;
+            std::cerr << "       " << argv[0] << " --self-test [--threads N] [--deadline-ms MS]" << std::endl;
+            std::cerr << "       " << argv[0] << " --bench-backends" << std::endl;
+            std::cerr << "       " << argv[0] << " --bench [--threads MAX] [--backend NAME] [--seed N] [--jobs N]"
+                      << " [--nonces N] [--difficulty D] [--replay PATH]" << std::endl;
             return EXIT_FAILURE;
         }
 
         std::string address = argv[1];
-        BitcoinMiner miner(address);
+        if (address == "--bench-backends") {
+            return benchBackends();
+        }
+        int threads = 0;
+        std::string header;
+        std::string backend;
+        std::string pool;
+        std::string password = "x";
+        std::string statsFile;
+        std::string recordFile;
+        int deadlineMs = 250;
+        BenchOptions bench;
+        for (int i = 2; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            std::string value = argv[++i];
+            if (arg == "--threads") {
+                threads = std::stoi(value);
+            } else if (arg == "--header") {
+                header = value;
+            } else if (arg == "--backend") {
+                backend = value;
+            } else if (arg == "--pool") {
+                pool = value;
+            } else if (arg == "--password") {
+                password = value;
+            } else if (arg == "--stats-file") {
+                statsFile = value;
+            } else if (arg == "--record") {
+                recordFile = value;
+            } else if (arg == "--deadline-ms") {
+                deadlineMs = std::stoi(value);
+            } else if (arg == "--seed") {
+                bench.seed = std::stoull(value);
+            } else if (arg == "--jobs") {
+                bench.jobs = std::stoul(value);
+            } else if (arg == "--nonces") {
+                bench.noncesPerJob = std::min<uint64_t>(std::stoull(value), uint64_t(1) << 32);
+            } else if (arg == "--difficulty") {
+                bench.difficulty = std::stod(value);
+            } else if (arg == "--replay") {
+                bench.replayFile = value;
+            } else {
+                throw std::invalid_argument("Unknown option: " + arg);
+            }
+        }
+
+        if (address == "--self-test") {
+            return selfTest(threads > 0 ? threads : static_cast<int>(std::max(1u, std::thread::hardware_concurrency())),
+                            std::chrono::milliseconds(deadlineMs));
+        }
+        if (address == "--bench") {
+            bench.maxThreads = threads;
+            bench.backend = backend;
+            return benchReplay(bench);
+        }
+        BitcoinMiner miner(address, threads, header, backend, pool, password, statsFile, recordFile);
         miner.startMining();
     } catch (const std::exception &e) {
         std::cerr << "An error occurred: " << e.what() << std::endl;
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+namespace kickai {
+
+struct SchedulerOptions {
+    double hostRate = 20;   // sustained requests per second per host; 0 disables the limit
+    double hostBurst = 20;  // requests a host may take at once
+    int maxRetries = 4;     // attempts after the first for retryable failures
+    std::chrono::milliseconds baseBackoff{250};
+    std::chrono::milliseconds maxBackoff{15000};
+    std::chrono::milliseconds maxRetryAfter{60000}; // longest server-requested wait honoured
+    int minConcurrency = 1;
+    int maxConcurrency = 8;
+    double latencySpike = 3; // latency above this multiple of the running average counts as congestion
+};
+
+// Host part of a URL ("" for file:// and anything unparsable).
+inline std::string hostOf(const std::string &url) {
+    size_t scheme = url.find("://");
+    if (scheme == std::string::npos) {
+        return "";
+    }
+    size_t begin = scheme + 3;
+    size_t end = url.find_first_of("/?#", begin);
+    std::string authority = url.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+    size_t at = authority.rfind('@');
+    if (at != std::string::npos) {
+        authority.erase(0, at + 1);
+    }
+    return authority;
+}
+
+// Decides when requests may start, shared by the downloaders.
+//
+// - Per-host token buckets cap the request rate to each host. A throttled
+//   host (429/503) has its rate halved, then earns it back on successes.
+// - Failed requests are retried with exponential backoff and full jitter,
+//   or after the server's Retry-After when it sends one.
+// - The number of requests in flight follows AIMD: +1 per window of
+//   successes, halved on throttling, server errors or a latency spike, at
+//   most once per cool-down so one burst of failures counts once.
+//
+// Thread-safe; file:// URLs (empty host) are never rate limited.
+class FetchScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Outcome {
+        Success,
+        Throttled,    // 429 or 503
+        ServerError,  // other 5xx
+        NetworkError, // no HTTP response
+        Failed,       // other 4xx: not worth retrying
+    };
+
+    static Outcome classify(bool transferOk, long status) {
+        if (!transferOk) {
+            return Outcome::NetworkError;
+        }
+        if (status == 429 || status == 503) {
+            return Outcome::Throttled;
+        }
+        if (status >= 500) {
+            return Outcome::ServerError;
+        }
+        if (status >= 400) {
+            return Outcome::Failed;
+        }
+        return Outcome::Success;
+    }
+
+    explicit FetchScheduler(const SchedulerOptions &options = SchedulerOptions())
+        : options(options), window(std::max(1, std::min(options.maxConcurrency, 4))), random(std::random_device{}()) {
+        this->options.maxConcurrency = std::max(this->options.minConcurrency, options.maxConcurrency);
+        // A bucket that can never hold a whole token would never let a
+        // request through.
+        this->options.hostBurst = std::max(1.0, options.hostBurst);
+        this->options.hostRate = std::max(0.0, options.hostRate);
+    }
+
+    // Requests allowed in flight right now.
+    int concurrency() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return static_cast<int>(window);
+    }
+
+    // Takes a token for url's host if one is available; otherwise says when
+    // to ask again.
+    bool tryAcquire(const std::string &url, Clock::time_point now, Clock::time_point &retryAt) {
+        std::string host = hostOf(url);
+        if (options.hostRate <= 0 || host.empty()) {
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        Bucket &bucket = bucketFor(host, now);
+        refill(bucket, now);
+        if (now < bucket.blockedUntil) {
+            retryAt = bucket.blockedUntil;
+            return false;
+        }
+        if (bucket.tokens >= 1) {
+            bucket.tokens -= 1;
+            return true;
+        }
+        retryAt = now + std::chrono::duration_cast<Clock::duration>(
+                            std::chrono::duration<double>((1 - bucket.tokens) / bucket.rate));
+        return false;
+    }
+
+    // Feeds one finished request back. retryAfter is the server's
+    // Retry-After in seconds, or negative when absent.
+    void record(const std::string &url, Outcome outcome, Clock::duration latency, double retryAfter = -1) {
+        auto now = Clock::now();
+        std::lock_guard<std::mutex> lock(mutex);
+        ++counts[static_cast<int>(outcome)];
+        double ms = std::chrono::duration<double, std::milli>(latency).count();
+        bool spike = outcome == Outcome::Success && samples >= 20 && ms > options.latencySpike * averageMs;
+        if (outcome == Outcome::Success) {
+            averageMs = samples == 0 ? ms : averageMs + 0.1 * (ms - averageMs);
+            ++samples;
+        }
+
+        if (outcome == Outcome::Throttled || outcome == Outcome::ServerError || spike) {
+            if (now >= cooledDown) {
+                window = std::max<double>(options.minConcurrency, window / 2);
+                cooledDown = now + std::chrono::seconds(1);
+                ++decreases;
+            }
+        } else if (outcome == Outcome::Success) {
+            window = std::min<double>(options.maxConcurrency, window + 1 / window);
+        }
+
+        std::string host = hostOf(url);
+        if (options.hostRate <= 0 || host.empty()) {
+            return;
+        }
+        Bucket &bucket = bucketFor(host, now);
+        refill(bucket, now);
+        if (outcome == Outcome::Throttled) {
+            bucket.rate = std::max(options.hostRate / 64, bucket.rate / 2);
+            bucket.tokens = std::min(bucket.tokens, 0.0);
+            if (retryAfter >= 0) {
+                bucket.blockedUntil = std::max(bucket.blockedUntil, now + serverDelay(retryAfter));
+            }
+        } else if (outcome == Outcome::Success) {
+            bucket.rate = std::min(options.hostRate, bucket.rate + options.hostRate / 20);
+        }
+    }
+
+    bool shouldRetry(Outcome outcome, int attempt) const {
+        return attempt < options.maxRetries && outcome != Outcome::Success && outcome != Outcome::Failed;
+    }
+
+    // Delay before retry number attempt + 1 (attempt counts from 0).
+    Clock::duration backoff(int attempt, double retryAfter = -1) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++retries;
+        if (retryAfter >= 0) {
+            return serverDelay(retryAfter);
+        }
+        double cap = std::min<double>(options.maxBackoff.count(),
+                                      options.baseBackoff.count() * std::ldexp(1.0, std::min(attempt, 30)));
+        std::uniform_real_distribution<double> jitter(0, cap);
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(jitter(random)));
+    }
+
+    std::string report() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ostringstream oss;
+        oss << "Scheduler: " << counts[0] << " ok, " << counts[1] << " throttled, " << counts[2] << " server errors, "
+            << counts[3] << " network errors, " << counts[4] << " failed, " << retries << " retries, window "
+            << window << " (" << decreases << " decreases), mean latency " << averageMs << " ms";
+        return oss.str();
+    }
+
+private:
+    struct Bucket {
+        double tokens;
+        double rate;
+        Clock::time_point updated;
+        Clock::time_point blockedUntil;
+    };
+
+    SchedulerOptions options;
+    std::mutex mutex;
+    double window;
+    std::unordered_map<std::string, Bucket> buckets;
+    Clock::time_point cooledDown;
+    double averageMs = 0;
+    size_t samples = 0;
+    size_t counts[5] = {};
+    size_t retries = 0;
+    size_t decreases = 0;
+    std::mt19937 random;
+
+    Bucket &bucketFor(const std::string &host, Clock::time_point now) {
+        auto it = buckets.find(host);
+        if (it == buckets.end()) {
+            it = buckets.emplace(host, Bucket{options.hostBurst, options.hostRate, now, now}).first;
+        }
+        return it->second;
+    }
+
+    // A Retry-After, capped at maxRetryAfter: a host asking for a day would
+    // otherwise stall its bucket and retries that long, and a huge value
+    // would overflow the clock's ticks.
+    Clock::duration serverDelay(double seconds) const {
+        double ms = std::min<double>(seconds * 1000, static_cast<double>(options.maxRetryAfter.count()));
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(ms));
+    }
+
+    // Callers pass their own now, so it can be older than the last refill
+    // by another thread; that must not take tokens back or rewind the clock.
+    void refill(Bucket &bucket, Clock::time_point now) {
+        if (now <= bucket.updated) {
+            return;
+        }
+        double seconds = std::chrono::duration<double>(now - bucket.updated).count();
+        bucket.tokens = std::min(options.hostBurst, bucket.tokens + seconds * bucket.rate);
+        bucket.updated = now;
+    }
+};
+
+} // namespace kickai
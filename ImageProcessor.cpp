@@ -5,24 +5,973 @@
 #include <vector>
 #include <filesystem>
 #include <curl/curl.h>
+#include <openssl/evp.h>
 #include <opencv2/opencv.hpp>
 #include <tensorflow/core/public/session.h>
 #include <tensorflow/core/platform/env.h>
 #include <tensorflow/core/protobuf/meta_graph.pb.h>
 #include <tensorflow/core/framework/tensor.h>
 #include <stdexcept>
-#include <iomanip>
-#include <ctime>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <list>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <strings.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cmath>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KICKAI_X86 1
+#endif
+#include "Logger.h"
+#include "BoundedQueue.h"
+#include "FetchScheduler.h"
 
 namespace fs = std::filesystem;
 using namespace tensorflow;
+using kickai::BoundedQueue;
+
+// Fused model-input preprocessing: bilinear resize to 224x224, BGR to RGB,
+// uint8 to float and per-channel normalization in one pass over the source,
+// written NHWC straight into the caller's tensor slot. Resize geometry
+// matches cv::resize with INTER_LINEAR (half-pixel centres, clamped edges).
+namespace preprocess {
+
+constexpr int kSize = 224;
+constexpr int kRowFloats = kSize * 3;
+
+// out = (pixel / 255 - mean[c]) / stddev[c], channels in RGB order.
+struct Normalization {
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    float stddev[3] = {1.0f, 1.0f, 1.0f};
+};
+
+// Largest difference from the OpenCV reference in [0, 1] pixel units:
+// cv::resize rounds to 8 bits with fixed-point weights, the fused path
+// interpolates in float.
+constexpr float kTolerance = 1.0f / 255;
+
+// Source index pair and weight of the second one, for each output position.
+inline void axisTaps(int srcLength, int *first, int *second, float *weight) {
+    double scale = static_cast<double>(srcLength) / kSize;
+    for (int d = 0; d < kSize; ++d) {
+        double f = (d + 0.5) * scale - 0.5;
+        int i = static_cast<int>(std::floor(f));
+        double frac = f - i;
+        if (i < 0) {
+            i = 0;
+            frac = 0;
+        }
+        if (i >= srcLength - 1) {
+            i = srcLength - 1;
+            frac = 0;
+        }
+        first[d] = i;
+        second[d] = std::min(i + 1, srcLength - 1);
+        weight[d] = static_cast<float>(frac);
+    }
+}
+
+// dst = lerp(top, bottom, wy) * scale + bias over n floats.
+using BlendRows = void (*)(const float *top, const float *bottom, float wy, const float *scale,
+                           const float *bias, float *dst, size_t n);
+
+inline void scalarBlend(const float *top, const float *bottom, float wy, const float *scale, const float *bias,
+                        float *dst, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = (top[i] + wy * (bottom[i] - top[i])) * scale[i] + bias[i];
+    }
+}
+
+#ifdef KICKAI_X86
+__attribute__((target("avx2,fma")))
+inline void avx2Blend(const float *top, const float *bottom, float wy, const float *scale, const float *bias,
+                      float *dst, size_t n) {
+    const __m256 w = _mm256_set1_ps(wy);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 t = _mm256_loadu_ps(top + i);
+        __m256 v = _mm256_fmadd_ps(w, _mm256_sub_ps(_mm256_loadu_ps(bottom + i), t), t);
+        _mm256_storeu_ps(dst + i, _mm256_fmadd_ps(v, _mm256_loadu_ps(scale + i), _mm256_loadu_ps(bias + i)));
+    }
+    scalarBlend(top + i, bottom + i, wy, scale + i, bias + i, dst + i, n - i);
+}
+#endif
+
+inline BlendRows selectedBlend() {
+#ifdef KICKAI_X86
+    static const BlendRows blend =
+        __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? avx2Blend : scalarBlend;
+    return blend;
+#else
+    return scalarBlend;
+#endif
+}
+
+// Horizontal pass for one source row, swapping BGR to RGB on the way.
+inline void interpolateRow(const uchar *row, const int *x0, const int *x1, const float *wx, float *out) {
+    for (int x = 0; x < kSize; ++x) {
+        const uchar *a = row + x0[x] * 3;
+        const uchar *b = row + x1[x] * 3;
+        float w = wx[x];
+        out[x * 3 + 0] = a[2] + w * (b[2] - a[2]);
+        out[x * 3 + 1] = a[1] + w * (b[1] - a[1]);
+        out[x * 3 + 2] = a[0] + w * (b[0] - a[0]);
+    }
+}
+
+// Writes kSize x kSize x 3 floats to dst from an 8-bit BGR image.
+inline void toTensor(const cv::Mat &image, const Normalization &norm, float *dst) {
+    if (image.type() != CV_8UC3 || image.empty()) {
+        throw std::invalid_argument("Preprocessing expects a non-empty 8-bit BGR image.");
+    }
+    int x0[kSize], x1[kSize], y0[kSize], y1[kSize];
+    float wx[kSize], wy[kSize];
+    axisTaps(image.cols, x0, x1, wx);
+    axisTaps(image.rows, y0, y1, wy);
+
+    float scale[kRowFloats], bias[kRowFloats];
+    for (int i = 0; i < kRowFloats; ++i) {
+        int c = i % 3;
+        scale[i] = 1.0f / (255.0f * norm.stddev[c]);
+        bias[i] = -norm.mean[c] / norm.stddev[c];
+    }
+
+    // Horizontally interpolated rows are cached, since neighbouring output
+    // rows often share source rows.
+    float rows[2][kRowFloats];
+    int cached[2] = {-1, -1};
+    auto horizontal = [&](int y, int keep) -> const float * {
+        for (int k = 0; k < 2; ++k) {
+            if (cached[k] == y) {
+                return rows[k];
+            }
+        }
+        int slot = cached[0] == keep ? 1 : 0;
+        interpolateRow(image.ptr<uchar>(y), x0, x1, wx, rows[slot]);
+        cached[slot] = y;
+        return rows[slot];
+    };
+
+    BlendRows blend = selectedBlend();
+    for (int y = 0; y < kSize; ++y) {
+        const float *top = horizontal(y0[y], -1);
+        const float *bottom = horizontal(y1[y], y0[y]);
+        blend(top, bottom, wy[y], scale, bias, dst + static_cast<size_t>(y) * kRowFloats, kRowFloats);
+    }
+}
+
+} // namespace preprocess
+
+struct PipelineOptions {
+    int connections = 8;       // concurrent transfers in the fetch stage
+    kickai::SchedulerOptions scheduler; // rate limits and retries; maxConcurrency comes from connections
+    int decodeWorkers = 4;
+    int maxBatch = 8;          // images per session->Run
+    std::chrono::microseconds maxBatchWait{2000}; // how long a batch may wait to fill
+    size_t queueDepth = 64;    // capacity of each inter-stage queue
+    bool reducedDecode = false; // let large JPEGs decode at 1/2, 1/4 or 1/8 scale
+    preprocess::Normalization normalization;
+
+    // TensorFlow session setup. Thread counts of 0 let TensorFlow decide.
+    int intraOpThreads = 0;
+    int interOpThreads = 0;
+    std::vector<int> cpus;     // confine the session's thread pools to these CPUs
+    bool graphOptimizer = true; // grappler/function-level optimizations
+    bool xlaJit = false;       // XLA CPU JIT for the whole graph
+    int warmupRounds = 2;      // dummy batches (full, then single) before serving
+
+    int topK = 5;              // classes kept per image
+    std::string labelsPath;    // class names, one per line; empty prints "Class <id>"
+    std::string predictionsPath; // JSON Lines sink; empty means <output_dir>/predictions.jsonl
+
+    std::string cacheDir;      // persistent result cache; empty disables it
+    size_t cacheEntries = 100000;
+
+    int writeWorkers = 2;      // threads saving images
+    size_t fsyncEvery = 0;     // syncfs() after this many saved images; 0 leaves it to the OS
+};
+
+// Recycles download buffers so steady-state transfers reuse capacity instead
+// of growing a fresh vector chunk by chunk.
+class BodyPool {
+public:
+    static constexpr size_t kMaxRetained = 16 << 20;
+
+    explicit BodyPool(size_t maxIdle) : maxIdle(maxIdle) {}
+
+    std::vector<uchar> acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.empty()) {
+            return {};
+        }
+        std::vector<uchar> body = std::move(idle.back());
+        idle.pop_back();
+        return body;
+    }
+
+    void release(std::vector<uchar> body) {
+        if (body.capacity() == 0 || body.capacity() > kMaxRetained) {
+            return;
+        }
+        body.clear();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.size() < maxIdle) {
+            idle.push_back(std::move(body));
+        }
+    }
+
+private:
+    size_t maxIdle;
+    std::mutex mutex;
+    std::vector<std::vector<uchar>> idle;
+};
+
+// Reads width and height from a JPEG's SOFn segment without decoding it.
+inline bool jpegDimensions(const std::vector<uchar> &data, int &width, int &height) {
+    if (data.size() < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+    size_t i = 2;
+    while (i + 3 < data.size()) {
+        if (data[i] != 0xFF) {
+            return false;
+        }
+        uchar marker = data[i + 1];
+        if (marker == 0xFF) {
+            ++i; // fill byte
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            i += 2; // markers without a length
+            continue;
+        }
+        size_t length = (static_cast<size_t>(data[i + 2]) << 8) | data[i + 3];
+        bool sof = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (sof) {
+            if (i + 8 >= data.size()) {
+                return false;
+            }
+            height = (data[i + 5] << 8) | data[i + 6];
+            width = (data[i + 7] << 8) | data[i + 8];
+            return width > 0 && height > 0;
+        }
+        if (marker == 0xDA || length < 2) {
+            return false; // image data started without a frame header
+        }
+        i += 2 + length;
+    }
+    return false;
+}
+
+// Image container by magic bytes: "jpeg", "png", "gif", "bmp", "webp",
+// "tiff", or "" when unknown.
+inline std::string sniffFormat(const std::vector<uchar> &data) {
+    auto starts = [&](const char *magic, size_t length, size_t offset = 0) {
+        return data.size() >= offset + length && std::memcmp(data.data() + offset, magic, length) == 0;
+    };
+    if (starts("\xFF\xD8\xFF", 3)) return "jpeg";
+    if (starts("\x89PNG", 4)) return "png";
+    if (starts("GIF8", 4)) return "gif";
+    if (starts("BM", 2)) return "bmp";
+    if (starts("RIFF", 4) && starts("WEBP", 4, 8)) return "webp";
+    if (starts("II*\0", 4) || starts("MM\0*", 4)) return "tiff";
+    return "";
+}
+
+// Container implied by a file name's extension, "" when unknown.
+inline std::string extensionFormat(const std::string &path) {
+    std::string ext = fs::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (ext == ".jpg" || ext == ".jpeg" || ext == ".jpe") return "jpeg";
+    if (ext == ".png") return "png";
+    if (ext == ".gif") return "gif";
+    if (ext == ".bmp") return "bmp";
+    if (ext == ".webp") return "webp";
+    if (ext == ".tif" || ext == ".tiff") return "tiff";
+    return "";
+}
+
+// Saves images on a small worker pool so writes stay off the pipeline's
+// critical path. Downloaded bytes are written as is whenever the file name's
+// extension matches their container; only a mismatch costs a re-encode
+// (cv::imwrite picks the encoder from the extension). Label directories are
+// created once per run. With fsyncEvery > 0 the output file system is
+// flushed with one syncfs() per fsyncEvery files and once more at the end.
+//
+// submit() is meant for a single producer thread.
+class ImageWriter {
+public:
+    struct Task {
+        std::string path;
+        std::vector<uchar> body;      // downloaded bytes, if still around
+        cv::Mat image;                // decoded pixels, for a re-encode
+        std::string copyFrom;         // or an earlier saved copy of the same image
+        bool encodedOnly = false;     // body is not a faithful copy of image (reduced decode)
+        std::function<void()> onWritten;
+    };
+
+    ImageWriter(const std::string &root, int workers, size_t queueDepth, size_t fsyncEvery, BodyPool &bodies,
+                kickai::Logger &logger)
+        : tasks(queueDepth), fsyncEvery(fsyncEvery), bodies(bodies), logger(logger) {
+        if (fsyncEvery > 0) {
+            rootFd = ::open(root.c_str(), O_RDONLY | O_DIRECTORY);
+            if (rootFd < 0) {
+                throw std::runtime_error("Could not open output directory " + root);
+            }
+        }
+        for (int i = 0; i < std::max(1, workers); ++i) {
+            threads.emplace_back([this] { run(); });
+        }
+    }
+
+    ~ImageWriter() {
+        finish();
+    }
+
+    ImageWriter(const ImageWriter &) = delete;
+    ImageWriter &operator=(const ImageWriter &) = delete;
+
+    void submit(Task task) {
+        std::string dir = fs::path(task.path).parent_path().string();
+        if (createdDirs.insert(dir).second) {
+            fs::create_directories(dir);
+        }
+        tasks.push(std::move(task));
+    }
+
+    // Waits for queued writes and the final sync.
+    void finish() {
+        if (threads.empty()) {
+            return;
+        }
+        tasks.close();
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+        if (rootFd >= 0) {
+            sync();
+            ::close(rootFd);
+            rootFd = -1;
+        }
+    }
+
+    std::string report() const {
+        std::ostringstream oss;
+        oss << "Image writer: " << raw.load() << " written as downloaded, " << encoded.load() << " re-encoded, "
+            << copied.load() << " copied, " << failed.load() << " failed, " << syncs.load() << " syncs";
+        return oss.str();
+    }
+
+private:
+    BoundedQueue<Task> tasks;
+    size_t fsyncEvery;
+    BodyPool &bodies;
+    kickai::Logger &logger;
+    std::unordered_set<std::string> createdDirs; // submit() thread only
+    std::vector<std::thread> threads;
+    int rootFd = -1;
+    std::atomic<size_t> raw{0}, encoded{0}, copied{0}, failed{0}, syncs{0};
+    std::atomic<size_t> sinceSync{0};
+
+    void sync() {
+        if (::syncfs(rootFd) != 0) {
+            logger.error("syncfs failed on the output directory.");
+        }
+        ++syncs;
+    }
+
+    void write(Task &task) {
+        if (!task.copyFrom.empty() && task.body.empty()) {
+            std::error_code error;
+            if (!fs::equivalent(task.copyFrom, task.path, error)) {
+                fs::copy_file(task.copyFrom, task.path, fs::copy_options::overwrite_existing);
+            }
+            ++copied;
+            return;
+        }
+        bool asDownloaded = !task.body.empty() &&
+                            (task.encodedOnly || task.image.empty() || sniffFormat(task.body) == extensionFormat(task.path));
+        if (asDownloaded) {
+            std::ofstream outFile(task.path, std::ios::binary);
+            outFile.write(reinterpret_cast<const char *>(task.body.data()), static_cast<std::streamsize>(task.body.size()));
+            if (!outFile) {
+                throw std::runtime_error("Could not write " + task.path);
+            }
+            ++raw;
+            return;
+        }
+        if (!cv::imwrite(task.path, task.image)) {
+            throw std::runtime_error("Could not encode " + task.path);
+        }
+        ++encoded;
+    }
+
+    void run() {
+        Task task;
+        while (tasks.pop(task)) {
+            try {
+                write(task);
+                logger.info("Image saved: " + task.path);
+                if (task.onWritten) {
+                    task.onWritten();
+                }
+            } catch (const std::exception &e) {
+                ++failed;
+                logger.error(std::string("Failed to save image: ") + e.what());
+            }
+            bodies.release(std::move(task.body));
+            task = Task();
+            if (fsyncEvery > 0 && ++sinceSync % fsyncEvery == 0) {
+                sync();
+            }
+        }
+    }
+};
+
+struct Prediction {
+    int classId;
+    float score;
+};
+
+// Highest-scoring classes first.
+using Predictions = std::vector<Prediction>;
+
+// Picks the k best of n scores with a k-element min-heap, so only the
+// winners are ever materialized.
+inline Predictions topK(const float *scores, int64_t n, int k) {
+    auto better = [](const Prediction &a, const Prediction &b) {
+        return a.score > b.score || (a.score == b.score && a.classId < b.classId);
+    };
+    Predictions heap;
+    size_t limit = static_cast<size_t>(std::max<int64_t>(0, std::min<int64_t>(k, n)));
+    heap.reserve(limit);
+    if (limit == 0) {
+        return heap;
+    }
+    for (int64_t c = 0; c < n; ++c) {
+        Prediction candidate{static_cast<int>(c), scores[c]};
+        if (heap.size() < limit) {
+            heap.push_back(candidate);
+            std::push_heap(heap.begin(), heap.end(), better);
+        } else if (better(candidate, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = candidate;
+            std::push_heap(heap.begin(), heap.end(), better);
+        }
+    }
+    std::sort_heap(heap.begin(), heap.end(), better);
+    return heap;
+}
+
+// Class names indexed by class id, one per line; ids past the end of the
+// file (or every id, without a file) print as "Class <id>".
+class LabelTable {
+public:
+    LabelTable() = default;
+
+    explicit LabelTable(const std::string &path) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            throw std::runtime_error("Could not open labels file: " + path);
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            names.push_back(line);
+        }
+    }
+
+    std::string name(int classId) const {
+        if (classId >= 0 && static_cast<size_t>(classId) < names.size()) {
+            return names[classId];
+        }
+        return "Class " + std::to_string(classId);
+    }
+
+private:
+    std::vector<std::string> names;
+};
+
+// Append-only JSON Lines file with one record per image:
+// {"url":...,"label":...,"top":[{"id":3,"name":"...","score":0.91},...]}
+// Records are buffered and written with one fwrite per batch.
+class PredictionSink {
+public:
+    static constexpr size_t kBatchBytes = 256 << 10;
+
+    PredictionSink(const std::string &path, const LabelTable &labels) : labels(labels) {
+        file = std::fopen(path.c_str(), "a");
+        if (!file) {
+            throw std::runtime_error("Could not open predictions file: " + path);
+        }
+        buffer.reserve(kBatchBytes + 4096);
+    }
+
+    ~PredictionSink() {
+        flush();
+        std::fclose(file);
+    }
+
+    PredictionSink(const PredictionSink &) = delete;
+    PredictionSink &operator=(const PredictionSink &) = delete;
+
+    void write(const std::string &url, const std::string &label, const Predictions &predictions) {
+        buffer += "{\"url\":";
+        appendString(url);
+        buffer += ",\"label\":";
+        appendString(label);
+        buffer += ",\"top\":[";
+        char score[32];
+        for (size_t i = 0; i < predictions.size(); ++i) {
+            if (i > 0) {
+                buffer += ',';
+            }
+            buffer += "{\"id\":";
+            buffer += std::to_string(predictions[i].classId);
+            buffer += ",\"name\":";
+            appendString(labels.name(predictions[i].classId));
+            // JSON has no nan or inf; a model that produced one gets a null.
+            if (std::isfinite(predictions[i].score)) {
+                std::snprintf(score, sizeof(score), ",\"score\":%.6g}", predictions[i].score);
+                buffer += score;
+            } else {
+                buffer += ",\"score\":null}";
+            }
+        }
+        buffer += "]}\n";
+        ++records;
+        if (buffer.size() >= kBatchBytes) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (!buffer.empty()) {
+            std::fwrite(buffer.data(), 1, buffer.size(), file);
+            std::fflush(file);
+            buffer.clear();
+        }
+    }
+
+    size_t count() const { return records; }
+
+private:
+    const LabelTable &labels;
+    std::FILE *file;
+    std::string buffer;
+    size_t records = 0;
+
+    void appendString(const std::string &text) {
+        buffer += '"';
+        for (unsigned char c : text) {
+            switch (c) {
+            case '"': buffer += "\\\""; break;
+            case '\\': buffer += "\\\\"; break;
+            case '\n': buffer += "\\n"; break;
+            case '\r': buffer += "\\r"; break;
+            case '\t': buffer += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    buffer += escaped;
+                } else {
+                    buffer += static_cast<char>(c);
+                }
+            }
+        }
+        buffer += '"';
+    }
+};
+
+// 64-bit FNV-1a; stable across builds, which a persistent cache key needs.
+inline uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    const uchar *bytes = static_cast<const uchar *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Lowercase hex SHA-256 of data. Used as the result cache's content key, where
+// a collision would hand one image another image's predictions.
+inline std::string sha256Hex(const void *data, size_t size) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int length = 0;
+    if (EVP_Digest(data, size, digest, &length, EVP_sha256(), nullptr) != 1) {
+        throw std::runtime_error("SHA-256 failed");
+    }
+    static const char kHex[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(2 * length);
+    for (unsigned int i = 0; i < length; ++i) {
+        hex += kHex[digest[i] >> 4];
+        hex += kHex[digest[i] & 15];
+    }
+    return hex;
+}
+
+// Persistent results keyed by URL and by content hash, so an unchanged image
+// costs one lookup instead of download, decode and inference.
+//
+// An entry holds the HTTP validators (ETag, Last-Modified) for conditional
+// re-fetches, the SHA-256 and length of the body, where the image was saved and
+// its predictions. The index lives in <dir>/index.tsv, oldest entry first,
+// and is rewritten atomically by save(). It is tagged with a fingerprint of
+// the model and of every option that changes predictions; a different
+// fingerprint starts an empty cache. Past maxEntries the least recently used
+// entries are evicted.
+class ResultCache {
+public:
+    struct Entry {
+        std::string url;
+        std::string contentHash; // SHA-256 of the body, hex
+        size_t contentLength = 0;
+        std::string etag;
+        std::string lastModified;
+        std::string savedPath;
+        Predictions predictions;
+    };
+
+    ResultCache(const std::string &dir, uint64_t fingerprint, size_t maxEntries)
+        : path(dir + "/index.tsv"), fingerprint(fingerprint), maxEntries(std::max<size_t>(1, maxEntries)) {
+        fs::create_directories(dir);
+        load();
+    }
+
+    // Validators for a conditional request, if the entry and its saved image
+    // are still around.
+    bool validators(const std::string &url, std::string &etag, std::string &lastModified) {
+        std::string savedPath;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = byUrl.find(url);
+            if (it == byUrl.end() || (it->second->etag.empty() && it->second->lastModified.empty())) {
+                return false;
+            }
+            etag = it->second->etag;
+            lastModified = it->second->lastModified;
+            savedPath = it->second->savedPath;
+        }
+        std::error_code error;
+        return fs::exists(savedPath, error);
+    }
+
+    // The server answered 304 for url.
+    bool revalidated(const std::string &url, Entry &out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = byUrl.find(url);
+        if (it == byUrl.end()) {
+            return false;
+        }
+        touch(it->second);
+        out = *it->second;
+        ++revalidatedHits;
+        return true;
+    }
+
+    // A downloaded body whose content was seen before, under any URL.
+    bool findContent(const std::string &contentHash, size_t contentLength, Entry &out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = byContent.find(contentHash);
+        if (it == byContent.end() || it->second->contentLength != contentLength) {
+            ++misses;
+            return false;
+        }
+        touch(it->second);
+        out = *it->second;
+        ++contentHits;
+        return true;
+    }
+
+    void store(Entry entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        insert(std::move(entry));
+        dirty = true;
+    }
+
+    void save() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!dirty) {
+            return;
+        }
+        std::string temp = path + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::trunc);
+            out << "kickai-result-cache 2 " << std::hex << fingerprint << std::dec << "\n";
+            for (const Entry &entry : entries) {
+                out << entry.url << '\t' << entry.contentHash << '\t' << entry.contentLength << '\t' << entry.etag
+                    << '\t' << entry.lastModified << '\t' << entry.savedPath << '\t';
+                for (size_t i = 0; i < entry.predictions.size(); ++i) {
+                    out << (i ? "," : "") << entry.predictions[i].classId << ':' << entry.predictions[i].score;
+                }
+                out << '\n';
+            }
+            if (!out) {
+                throw std::runtime_error("Could not write cache index " + temp);
+            }
+        }
+        fs::rename(temp, path);
+        dirty = false;
+    }
+
+    std::string report() {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t lookups = revalidatedHits + contentHits + misses;
+        std::ostringstream oss;
+        oss << "Result cache: " << revalidatedHits << " revalidated (304), " << contentHits << " content hits, "
+            << misses << " misses, hit rate "
+            << (lookups ? 100.0 * (revalidatedHits + contentHits) / lookups : 0.0) << "%, " << evictions
+            << " evictions, " << entries.size() << "/" << maxEntries << " entries";
+        return oss.str();
+    }
+
+private:
+    using Iterator = std::list<Entry>::iterator;
+
+    std::string path;
+    uint64_t fingerprint;
+    size_t maxEntries;
+    std::mutex mutex;
+    std::list<Entry> entries; // least recently used first
+    std::unordered_map<std::string, Iterator> byUrl;
+    std::unordered_map<std::string, Iterator> byContent;
+    size_t revalidatedHits = 0;
+    size_t contentHits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    bool dirty = false;
+
+    void touch(Iterator it) {
+        entries.splice(entries.end(), entries, it);
+        dirty = true;
+    }
+
+    void unlink(Iterator it) {
+        byUrl.erase(it->url);
+        auto content = byContent.find(it->contentHash);
+        if (content != byContent.end() && content->second == it) {
+            byContent.erase(content);
+        }
+        entries.erase(it);
+    }
+
+    void insert(Entry entry) {
+        auto existing = byUrl.find(entry.url);
+        if (existing != byUrl.end()) {
+            unlink(existing->second);
+        }
+        entries.push_back(std::move(entry));
+        Iterator it = std::prev(entries.end());
+        byUrl[it->url] = it;
+        byContent[it->contentHash] = it;
+        while (entries.size() > maxEntries) {
+            unlink(entries.begin());
+            ++evictions;
+        }
+    }
+
+    void load() {
+        std::ifstream in(path);
+        std::string line;
+        if (!in.is_open() || !std::getline(in, line)) {
+            return;
+        }
+        std::istringstream header(line);
+        std::string magic;
+        int version = 0;
+        uint64_t stored = 0;
+        header >> magic >> version >> std::hex >> stored;
+        if (magic != "kickai-result-cache" || version != 2 || stored != fingerprint) {
+            dirty = true; // model or options changed: start over
+            return;
+        }
+        while (std::getline(in, line)) {
+            std::vector<std::string> fields;
+            std::istringstream iss(line);
+            std::string field;
+            while (std::getline(iss, field, '\t')) {
+                fields.push_back(field);
+            }
+            if (fields.size() < 6) {
+                continue;
+            }
+            Entry entry;
+            entry.url = fields[0];
+            entry.contentHash = fields[1];
+            entry.contentLength = std::strtoull(fields[2].c_str(), nullptr, 10);
+            entry.etag = fields[3];
+            entry.lastModified = fields[4];
+            entry.savedPath = fields[5];
+            if (fields.size() > 6) {
+                std::istringstream top(fields[6]);
+                std::string item;
+                while (std::getline(top, item, ',')) {
+                    size_t colon = item.find(':');
+                    if (colon != std::string::npos) {
+                        entry.predictions.push_back({std::stoi(item.substr(0, colon)), std::stof(item.substr(colon + 1))});
+                    }
+                }
+            }
+            insert(std::move(entry));
+        }
+        evictions = 0;
+    }
+};
+
+// Collects single-image requests from any thread into batches of up to
+// maxBatch, waiting at most maxWait after the oldest request, and runs each
+// batch with one call. Results are handed back through per-request futures.
+class BatchingPredictor {
+public:
+    using RunBatch = std::function<std::vector<Predictions>(const std::vector<const cv::Mat *> &)>;
+
+    BatchingPredictor(RunBatch run, int maxBatch, std::chrono::microseconds maxWait)
+        : run(std::move(run)), maxBatch(static_cast<size_t>(std::max(1, maxBatch))), maxWait(maxWait),
+          started(std::chrono::steady_clock::now()), worker([this] { loop(); }) {}
+
+    ~BatchingPredictor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        worker.join();
+    }
+
+    // image must stay alive until the future is ready.
+    std::future<Predictions> submit(const cv::Mat &image) {
+        Request request{&image, {}, std::chrono::steady_clock::now()};
+        auto future = request.result.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(std::move(request));
+        }
+        ready.notify_one();
+        return future;
+    }
+
+    // Throughput, batch fill and request latency (submit to result) so far.
+    // Call once submitters are done.
+    std::string report() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (latencies.empty()) {
+            return "Inference: no images.";
+        }
+        std::vector<double> sorted = latencies;
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&](double p) {
+            return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+        };
+        double seconds = std::chrono::duration<double>(lastResult - started).count();
+        std::ostringstream oss;
+        oss << "Inference: " << sorted.size() << " images in " << batches << " batches (mean "
+            << static_cast<double>(sorted.size()) / batches << "/" << maxBatch << "), "
+            << sorted.size() / std::max(seconds, 1e-9) << " images/s, latency ms p50 " << percentile(0.50)
+            << " p90 " << percentile(0.90) << " p99 " << percentile(0.99) << " max " << sorted.back();
+        return oss.str();
+    }
+
+private:
+    struct Request {
+        const cv::Mat *image;
+        std::promise<Predictions> result;
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    RunBatch run;
+    size_t maxBatch;
+    std::chrono::microseconds maxWait;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Request> pending;
+    bool stopping = false;
+    std::vector<double> latencies; // milliseconds, guarded by mutex
+    size_t batches = 0;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point lastResult;
+    std::thread worker;
+
+    void loop() {
+        std::vector<Request> batch;
+        std::vector<const cv::Mat *> images;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return stopping || !pending.empty(); });
+                if (pending.empty()) {
+                    return;
+                }
+                auto deadline = pending.front().submitted + maxWait;
+                ready.wait_until(lock, deadline, [this] { return stopping || pending.size() >= maxBatch; });
+                while (!pending.empty() && batch.size() < maxBatch) {
+                    batch.push_back(std::move(pending.front()));
+                    pending.pop_front();
+                }
+            }
+
+            for (const auto &request : batch) {
+                images.push_back(request.image);
+            }
+            try {
+                std::vector<Predictions> results = run(images);
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    batch[i].result.set_value(std::move(results[i]));
+                }
+            } catch (...) {
+                for (auto &request : batch) {
+                    request.result.set_exception(std::current_exception());
+                }
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (const auto &request : batch) {
+                    latencies.push_back(std::chrono::duration<double, std::milli>(now - request.submitted).count());
+                }
+                ++batches;
+                lastResult = now;
+            }
+            batch.clear();
+            images.clear();
+        }
+    }
+};
 
 class ImageProcessor {
 public:
-    ImageProcessor(const std::string &model_path, const std::string &log_file)
-        : log_file(log_file) {
+    ImageProcessor(const std::string &model_path, const std::string &log_file,
+                   const PipelineOptions &options = PipelineOptions())
+        : logger(log_file, kickai::LogLevel::Info, true), options(options),
+          bodies(options.queueDepth * 3 + static_cast<size_t>(std::max(1, options.connections))),
+          labels(options.labelsPath.empty() ? LabelTable() : LabelTable(options.labelsPath)),
+          scheduler(schedulerOptions(options)) {
+        logger.info("Image processing started.");
         loadModel(model_path);
-        initializeLog();
+        if (!options.cacheDir.empty()) {
+            cache = std::make_unique<ResultCache>(options.cacheDir, fingerprint(model_path), options.cacheEntries);
+        }
     }
 
     ~ImageProcessor() {
@@ -31,6 +980,9 @@ public:
         }
     }
 
+    // Runs the URL list through four stages connected by bounded queues:
+    // curl-multi fetch -> decode pool -> inference -> writer. Each line is
+    // "url,label"; file:// URLs work too, which makes offline runs easy.
     void processImages(const std::string &image_urls_file, const std::string &output_dir) {
         std::ifstream file(image_urls_file);
         if (!file.is_open()) {
@@ -38,144 +990,674 @@ public:
             throw std::runtime_error("File open error.");
         }
 
-        std::string line;
-        while (std::getline(file, line)) {
-            std::istringstream iss(line);
-            std::string url, label;
-            std::getline(iss, url, ',');
-            std::getline(iss, label);
-
-            cv::Mat image = loadImageFromUrl(url);
-            if (!image.empty()) {
-                auto predictions = predictImage(image);
-                saveImage(image, output_dir, label, url);
-                logPredictions(predictions);
-            } else {
-                log("Failed to process image from: " + url);
+        BoundedQueue<std::unique_ptr<ImageJob>> decodeQueue(options.queueDepth);
+        BoundedQueue<std::unique_ptr<ImageJob>> inferQueue(options.queueDepth);
+        BoundedQueue<std::unique_ptr<ImageJob>> writeQueue(options.queueDepth);
+
+        std::vector<std::thread> decoders;
+        for (int i = 0; i < std::max(1, options.decodeWorkers); ++i) {
+            decoders.emplace_back([&] { decodeStage(decodeQueue, inferQueue); });
+        }
+        BatchingPredictor predictor([this](const std::vector<const cv::Mat *> &images) { return predictBatch(images); },
+                                    options.maxBatch, options.maxBatchWait);
+        std::thread inference([&] { inferenceStage(inferQueue, writeQueue, predictor); });
+        fs::create_directories(output_dir);
+        PredictionSink sink(options.predictionsPath.empty() ? output_dir + "/predictions.jsonl"
+                                                            : options.predictionsPath,
+                            labels);
+        ImageWriter files(output_dir, options.writeWorkers, options.queueDepth, options.fsyncEvery, bodies, logger);
+        std::thread writer([&] { writeStage(writeQueue, output_dir, sink, files); });
+
+        try {
+            fetchStage(file, decodeQueue);
+        } catch (...) {
+            decodeQueue.close();
+            inferQueue.close();
+            for (auto &decoder : decoders) {
+                decoder.join();
             }
+            // Close writeQueue only once inference is done: a job it failed
+            // to push would be destroyed, image and all, while the predictor
+            // may still hold a pointer to that image in a pending batch.
+            inference.join();
+            writeQueue.close();
+            writer.join();
+            throw;
         }
+        decodeQueue.close();
+        for (auto &decoder : decoders) {
+            decoder.join();
+        }
+        inferQueue.close();
+        inference.join();
+        writeQueue.close();
+        writer.join();
+        files.finish();
+        log(predictor.report());
+        log(files.report());
+        sink.flush();
+        if (cache) {
+            cache->save();
+            log(cache->report());
+        }
+        log(runs.report());
+        log(scheduler.report());
+        log("Predictions written: " + std::to_string(sink.count()));
     }
 
     void log(const std::string &message) {
-        std::ofstream logFile(log_file, std::ios_base::app);
-        logFile << currentDateTime() << " - " << message << std::endl;
+        logger.info(message);
     }
 
 private:
+    struct ImageJob {
+        std::string url;
+        std::string label;
+        std::vector<uchar> body;
+        cv::Mat image;
+        bool reduced = false; // image was decoded below the source resolution
+        std::future<Predictions> pending;
+        Predictions predictions;
+
+        // Result cache bookkeeping.
+        bool cached = false;      // predictions came from the cache; skip decode and inference
+        std::string cachedPath;   // where the cached result's image was saved
+        std::string contentHash;
+        size_t contentLength = 0;
+        std::string etag;
+        std::string lastModified;
+        curl_slist *conditions = nullptr; // If-None-Match / If-Modified-Since
+
+        int attempt = 0; // retries so far
+        std::chrono::steady_clock::time_point started;
+
+        ~ImageJob() { curl_slist_free_all(conditions); }
+    };
+
+    // A job waiting for a host token or a retry.
+    struct Delayed {
+        kickai::FetchScheduler::Clock::time_point readyAt;
+        std::unique_ptr<ImageJob> job;
+    };
+
+    static bool laterFirst(const Delayed &a, const Delayed &b) { return a.readyAt > b.readyAt; }
+
+    static kickai::SchedulerOptions schedulerOptions(const PipelineOptions &options) {
+        kickai::SchedulerOptions result = options.scheduler;
+        result.maxConcurrency = std::max(1, options.connections);
+        return result;
+    }
+
+    // Session::Run latency once serving starts: the first request on its own,
+    // since that is where lazy initialization shows, and the rest as the
+    // steady state.
+    struct RunLatency {
+        std::mutex mutex;
+        bool serving = false; // set after warm-up, before any other thread runs
+        double firstMs = -1;
+        size_t firstImages = 0;
+        std::vector<double> steadyMs;
+
+        void record(double ms, size_t images) {
+            if (!serving) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (firstMs < 0) {
+                firstMs = ms;
+                firstImages = images;
+            } else {
+                steadyMs.push_back(ms);
+            }
+        }
+
+        std::string report() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (firstMs < 0) {
+                return "Session run: no requests.";
+            }
+            std::ostringstream oss;
+            oss << "Session run: first request " << firstMs << " ms (" << firstImages << " images)";
+            if (!steadyMs.empty()) {
+                std::vector<double> sorted = steadyMs;
+                std::sort(sorted.begin(), sorted.end());
+                auto percentile = [&](double p) {
+                    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+                };
+                oss << ", steady state over " << sorted.size() << " runs ms p50 " << percentile(0.50) << " p90 "
+                    << percentile(0.90) << " p99 " << percentile(0.99) << " max " << sorted.back();
+            }
+            return oss.str();
+        }
+    };
+
+    kickai::Logger logger;
+    PipelineOptions options;
+    BodyPool bodies;
+    LabelTable labels;
+    kickai::FetchScheduler scheduler;
     std::unique_ptr<Session> session;
-    std::string log_file;
+    RunLatency runs;
+    std::unique_ptr<ResultCache> cache;
+
+    static constexpr size_t kMaxReserve = 64 << 20;
+
+    static size_t appendBodyCallback(void *contents, size_t size, size_t nmemb, std::vector<uchar> *body) {
+        size_t totalSize = size * nmemb;
+        body->insert(body->end(), static_cast<uchar *>(contents), static_cast<uchar *>(contents) + totalSize);
+        return totalSize;
+    }
+
+    // Value of a "Name: value" header line if it matches name (lower case,
+    // with the colon), trimmed of surrounding whitespace.
+    static bool headerValue(const char *buffer, size_t size, const char *name, std::string &value) {
+        size_t nameLength = std::strlen(name);
+        if (size <= nameLength || strncasecmp(buffer, name, nameLength) != 0) {
+            return false;
+        }
+        size_t begin = nameLength, end = size;
+        while (begin < end && std::isspace(static_cast<unsigned char>(buffer[begin]))) {
+            ++begin;
+        }
+        while (end > begin && std::isspace(static_cast<unsigned char>(buffer[end - 1]))) {
+            --end;
+        }
+        value.assign(buffer + begin, end - begin);
+        return true;
+    }
+
+    // Reserves the whole body up front when the server announces its size,
+    // and keeps the validators of the final response for the result cache.
+    static size_t headerCallback(char *buffer, size_t size, size_t nitems, ImageJob *job) {
+        size_t totalSize = size * nitems;
+        std::string value;
+        if (totalSize > 5 && std::strncmp(buffer, "HTTP/", 5) == 0) {
+            job->etag.clear(); // a new response after a redirect
+            job->lastModified.clear();
+        } else if (headerValue(buffer, totalSize, "content-length:", value)) {
+            unsigned long long length = std::strtoull(value.c_str(), nullptr, 10);
+            if (length > 0 && length <= kMaxReserve) {
+                job->body.reserve(static_cast<size_t>(length));
+            }
+        } else if (headerValue(buffer, totalSize, "etag:", value)) {
+            job->etag = value;
+        } else if (headerValue(buffer, totalSize, "last-modified:", value)) {
+            job->lastModified = value;
+        }
+        return totalSize;
+    }
+
+    // Identifies everything that shapes a cached prediction: the model bytes
+    // plus the options that change what the model sees or what is kept.
+    uint64_t fingerprint(const std::string &model_path) const {
+        std::ifstream model(model_path, std::ios::binary);
+        uint64_t hash = fnv1a(nullptr, 0);
+        char chunk[1 << 16];
+        while (model.read(chunk, sizeof(chunk)) || model.gcount() > 0) {
+            hash = fnv1a(chunk, static_cast<size_t>(model.gcount()), hash);
+        }
+        const auto &norm = options.normalization;
+        hash = fnv1a(norm.mean, sizeof(norm.mean), hash);
+        hash = fnv1a(norm.stddev, sizeof(norm.stddev), hash);
+        hash = fnv1a(&options.topK, sizeof(options.topK), hash);
+        return fnv1a(&options.reducedDecode, sizeof(options.reducedDecode), hash);
+    }
+
+    // Keeps up to scheduler.concurrency() transfers in flight on one multi
+    // handle, so connections are reused and network waits overlap. Starts
+    // wait for a host token; throttled and failed transfers go back in line
+    // after a backoff. Blocks on a full decode queue, which pauses new
+    // transfers until decoding catches up.
+    void fetchStage(std::istream &urls, BoundedQueue<std::unique_ptr<ImageJob>> &decodeQueue) {
+        CURLM *multi = curl_multi_init();
+        if (!multi) {
+            throw std::runtime_error("Failed to create curl multi handle.");
+        }
+        curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(options.connections));
+
+        std::unordered_map<CURL *, std::unique_ptr<ImageJob>> active;
+        std::vector<CURL *> idleHandles;
+        std::vector<Delayed> delayed; // heap, earliest first
+        const size_t maxDelayed = static_cast<size_t>(std::max(1, options.connections)) * 4;
+        bool moreUrls = true;
+        std::string line;
+
+        while (moreUrls || !active.empty() || !delayed.empty()) {
+            auto now = kickai::FetchScheduler::Clock::now();
+            while (active.size() < static_cast<size_t>(scheduler.concurrency())) {
+                std::unique_ptr<ImageJob> job;
+                if (!delayed.empty() && delayed.front().readyAt <= now) {
+                    std::pop_heap(delayed.begin(), delayed.end(), laterFirst);
+                    job = std::move(delayed.back().job);
+                    delayed.pop_back();
+                } else if (!moreUrls || delayed.size() >= maxDelayed) {
+                    break;
+                } else if (!std::getline(urls, line)) {
+                    moreUrls = false;
+                    break;
+                } else if (line.empty()) {
+                    continue;
+                } else {
+                    job = std::make_unique<ImageJob>();
+                    job->body = bodies.acquire();
+                    std::istringstream iss(line);
+                    std::getline(iss, job->url, ',');
+                    std::getline(iss, job->label);
+                }
+
+                kickai::FetchScheduler::Clock::time_point retryAt;
+                if (!scheduler.tryAcquire(job->url, now, retryAt)) {
+                    delayed.push_back({retryAt, std::move(job)});
+                    std::push_heap(delayed.begin(), delayed.end(), laterFirst);
+                    continue;
+                }
+
+                CURL *curl = idleHandles.empty() ? curl_easy_init() : idleHandles.back();
+                if (!idleHandles.empty()) {
+                    idleHandles.pop_back();
+                }
+                if (!curl) {
+                    log("Failed to download image: " + job->url);
+                    bodies.release(std::move(job->body));
+                    continue;
+                }
+                curl_easy_reset(curl);
+                curl_easy_setopt(curl, CURLOPT_URL, job->url.c_str());
+                curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+                curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, appendBodyCallback);
+                curl_easy_setopt(curl, CURLOPT_WRITEDATA, &job->body);
+                curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerCallback);
+                curl_easy_setopt(curl, CURLOPT_HEADERDATA, job.get());
+                std::string etag, lastModified;
+                if (cache && cache->validators(job->url, etag, lastModified)) {
+                    if (!etag.empty()) {
+                        job->conditions = curl_slist_append(job->conditions, ("If-None-Match: " + etag).c_str());
+                    }
+                    if (!lastModified.empty()) {
+                        job->conditions =
+                            curl_slist_append(job->conditions, ("If-Modified-Since: " + lastModified).c_str());
+                    }
+                    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, job->conditions);
+                }
+                job->started = now;
+                curl_multi_add_handle(multi, curl);
+                active.emplace(curl, std::move(job));
+            }
+
+            int running = 0;
+            curl_multi_perform(multi, &running);
+
+            int queued = 0;
+            while (CURLMsg *msg = curl_multi_info_read(multi, &queued)) {
+                if (msg->msg != CURLMSG_DONE) {
+                    continue;
+                }
+                CURL *curl = msg->easy_handle;
+                CURLcode res = msg->data.result;
+                long status = 0;
+                curl_off_t retryAfter = 0;
+                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+                curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retryAfter);
+                curl_multi_remove_handle(multi, curl);
+                idleHandles.push_back(curl);
+
+                auto job = std::move(active[curl]);
+                active.erase(curl);
+                curl_slist_free_all(job->conditions);
+                job->conditions = nullptr;
+
+                auto outcome = kickai::FetchScheduler::classify(res == CURLE_OK, status);
+                auto finishedAt = kickai::FetchScheduler::Clock::now();
+                double serverDelay = retryAfter > 0 ? static_cast<double>(retryAfter) : -1;
+                scheduler.record(job->url, outcome, finishedAt - job->started, serverDelay);
+                if (outcome != kickai::FetchScheduler::Outcome::Success && scheduler.shouldRetry(outcome, job->attempt)) {
+                    std::string failure = res != CURLE_OK ? curl_easy_strerror(res) : "HTTP " + std::to_string(status);
+                    auto readyAt = finishedAt + scheduler.backoff(job->attempt, serverDelay);
+                    ++job->attempt;
+                    log("Retrying (" + failure + ") attempt " + std::to_string(job->attempt) + ": " + job->url);
+                    job->body.clear();
+                    delayed.push_back({readyAt, std::move(job)});
+                    std::push_heap(delayed.begin(), delayed.end(), laterFirst);
+                    continue;
+                }
+
+                ResultCache::Entry entry;
+                if (res == CURLE_OK && status == 304 && cache && cache->revalidated(job->url, entry)) {
+                    job->cached = true;
+                    job->cachedPath = entry.savedPath;
+                    job->predictions = std::move(entry.predictions);
+                    job->contentHash = entry.contentHash;
+                    job->contentLength = entry.contentLength;
+                    if (job->etag.empty() && job->lastModified.empty()) {
+                        job->etag = entry.etag; // a 304 need not repeat the validators
+                        job->lastModified = entry.lastModified;
+                    }
+                    bodies.release(std::move(job->body));
+                    decodeQueue.push(std::move(job));
+                    continue;
+                }
+                if (res != CURLE_OK || status >= 400 || status == 304) {
+                    log("Failed to download image: " + job->url);
+                    log("Failed to process image from: " + job->url);
+                    bodies.release(std::move(job->body));
+                    continue;
+                }
+                decodeQueue.push(std::move(job));
+            }
+
+            if (!active.empty() || !delayed.empty()) {
+                int timeoutMs = 100;
+                if (!delayed.empty()) {
+                    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        delayed.front().readyAt - kickai::FetchScheduler::Clock::now());
+                    timeoutMs = static_cast<int>(std::max<int64_t>(0, std::min<int64_t>(timeoutMs, wait.count() + 1)));
+                }
+                curl_multi_poll(multi, nullptr, 0, timeoutMs, nullptr);
+            }
+        }
+
+        for (CURL *curl : idleHandles) {
+            curl_easy_cleanup(curl);
+        }
+        curl_multi_cleanup(multi);
+    }
+
+    void decodeStage(BoundedQueue<std::unique_ptr<ImageJob>> &in, BoundedQueue<std::unique_ptr<ImageJob>> &out) {
+        std::unique_ptr<ImageJob> job;
+        while (in.pop(job)) {
+            if (!job->cached && cache) {
+                job->contentHash = sha256Hex(job->body.data(), job->body.size());
+                job->contentLength = job->body.size();
+                ResultCache::Entry entry;
+                if (cache->findContent(job->contentHash, job->contentLength, entry)) {
+                    // Same bytes as an earlier result: skip inference, and
+                    // decoding too unless the writer must re-encode.
+                    job->cached = true;
+                    job->cachedPath = entry.savedPath;
+                    job->predictions = std::move(entry.predictions);
+                }
+            }
+            if (job->cached && (job->body.empty() || sniffFormat(job->body) == extensionFormat(job->url))) {
+                out.push(std::move(job));
+                continue;
+            }
+            // One decode of the complete body.
+            int flags = job->cached ? cv::IMREAD_COLOR : decodeFlags(job->body);
+            job->image = cv::imdecode(job->body, flags);
+            if (job->image.empty()) {
+                log("Failed to process image from: " + job->url);
+                bodies.release(std::move(job->body));
+                continue;
+            }
+            // The body goes on to the writer, which saves it as downloaded.
+            job->reduced = flags != cv::IMREAD_COLOR;
+            out.push(std::move(job));
+        }
+    }
+
+    // The largest IMREAD_REDUCED_* scale that keeps both sides at or above
+    // the 224x224 model input, so the later resize never upsamples.
+    int decodeFlags(const std::vector<uchar> &body) const {
+        int width = 0, height = 0;
+        if (!options.reducedDecode || !jpegDimensions(body, width, height)) {
+            return cv::IMREAD_COLOR;
+        }
+        int shorter = std::min(width, height);
+        if (shorter >= 224 * 8) {
+            return cv::IMREAD_REDUCED_COLOR_8;
+        }
+        if (shorter >= 224 * 4) {
+            return cv::IMREAD_REDUCED_COLOR_4;
+        }
+        if (shorter >= 224 * 2) {
+            return cv::IMREAD_REDUCED_COLOR_2;
+        }
+        return cv::IMREAD_COLOR;
+    }
+
+    // Hands every image to the batching predictor without waiting; the writer
+    // collects the result, so batches fill from everything in flight.
+    void inferenceStage(BoundedQueue<std::unique_ptr<ImageJob>> &in, BoundedQueue<std::unique_ptr<ImageJob>> &out,
+                        BatchingPredictor &predictor) {
+        std::unique_ptr<ImageJob> job;
+        while (in.pop(job)) {
+            if (!job->cached) {
+                job->pending = predictor.submit(job->image);
+            }
+            out.push(std::move(job));
+        }
+    }
+
+    // Collects predictions in input order and hands the image to the writer
+    // pool; the cache entry is recorded once the file is on disk.
+    void writeStage(BoundedQueue<std::unique_ptr<ImageJob>> &in, const std::string &output_dir, PredictionSink &sink,
+                    ImageWriter &files) {
+        std::unique_ptr<ImageJob> job;
+        while (in.pop(job)) {
+            if (!job->cached) {
+                try {
+                    job->predictions = job->pending.get();
+                } catch (const std::exception &e) {
+                    logger.error("Failed to process image from: " + job->url + ": " + e.what());
+                    bodies.release(std::move(job->body));
+                    continue;
+                }
+            }
+            try {
+                ImageWriter::Task task;
+                task.path = savePath(output_dir, job->label, job->url);
+                task.body = std::move(job->body);
+                task.encodedOnly = job->reduced;
+                task.image = std::move(job->image);
+                if (job->cached) {
+                    task.copyFrom = job->cachedPath;
+                }
+                if (cache) {
+                    ResultCache::Entry entry{job->url, job->contentHash, job->contentLength,
+                                             job->etag, job->lastModified,
+                                             fs::absolute(task.path).string(), job->predictions};
+                    ResultCache *results = cache.get();
+                    task.onWritten = [results, entry]() mutable { results->store(std::move(entry)); };
+                }
+                files.submit(std::move(task));
+                sink.write(job->url, job->label, job->predictions);
+            } catch (const std::exception &e) {
+                logger.error("Failed to save image from " + job->url + ": " + e.what());
+            }
+        }
+    }
 
     void loadModel(const std::string &model_path) {
-        Status status = NewSession(SessionOptions(), &session);
+        SessionOptions sessionOptions;
+        ConfigProto &config = sessionOptions.config;
+        config.set_intra_op_parallelism_threads(options.intraOpThreads);
+        config.set_inter_op_parallelism_threads(options.interOpThreads);
+        OptimizerOptions *optimizer = config.mutable_graph_options()->mutable_optimizer_options();
+        if (!options.graphOptimizer) {
+            optimizer->set_opt_level(OptimizerOptions::L0);
+            optimizer->set_do_constant_folding(false);
+            optimizer->set_do_common_subexpression_elimination(false);
+            optimizer->set_do_function_inlining(false);
+        }
+        optimizer->set_global_jit_level(options.xlaJit ? OptimizerOptions::ON_1 : OptimizerOptions::OFF);
+
+        // Pool threads inherit the affinity of the thread that creates them,
+        // so pinning means per-session pools spawned under a narrowed mask.
+        // The mask stays in place through warm-up, which is when lazily
+        // started pool threads come up.
+        cpu_set_t previous;
+        bool pinned = false;
+        if (!options.cpus.empty()) {
+            config.set_use_per_session_threads(true);
+            cpu_set_t mask;
+            CPU_ZERO(&mask);
+            for (int cpu : options.cpus) {
+                CPU_SET(cpu, &mask);
+            }
+            pinned = pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) == 0 &&
+                     pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+            if (!pinned) {
+                logger.warn("Could not pin the TensorFlow session to the requested CPUs.");
+            }
+        }
+
+        Status status = NewSession(sessionOptions, &session);
         if (!status.ok()) {
-            log("Error creating TensorFlow session: " + status.ToString());
+            logger.error("Error creating TensorFlow session: " + status.ToString());
             throw std::runtime_error("TensorFlow session error.");
         }
 
         MetaGraphDef meta_graph_def;
         status = ReadBinaryProto(Env::Default(), model_path, &meta_graph_def);
         if (!status.ok()) {
-            log("Error loading model: " + status.ToString());
+            logger.error("Error loading model: " + status.ToString());
             throw std::runtime_error("Model load error.");
         }
 
         status = session->Create(meta_graph_def.graph_def());
         if (!status.ok()) {
-            log("Error creating graph: " + status.ToString());
+            logger.error("Error creating graph: " + status.ToString());
             throw std::runtime_error("Graph creation error.");
         }
-    }
 
-    cv::Mat loadImageFromUrl(const std::string &url) {
-        CURL *curl;
-        CURLcode res;
-        cv::Mat image;
-
-        curl = curl_easy_init();
-        if (curl) {
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, nullptr);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, nullptr);
-            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeImageCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &image);
-            res = curl_easy_perform(curl);
-
-            if (res != CURLE_OK) {
-                log("Failed to download image: " + url);
-            }
-
-            curl_easy_cleanup(curl);
+        warmUp();
+        if (pinned) {
+            pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
         }
-        return image;
+        runs.serving = true;
     }
 
-    static size_t writeImageCallback(void *contents, size_t size, size_t nmemb, cv::Mat *image) {
-        size_t totalSize = size * nmemb;
-        std::vector<uchar> data(totalSize);
-        std::copy(static_cast<uchar*>(contents), static_cast<uchar*>(contents) + totalSize, data.begin());
-        image->imdecode(data, cv::IMREAD_COLOR); // Decode image from data
-        return totalSize;
+    // Runs dummy batches in the two shapes the batcher produces most (full
+    // under load, single when idle) so kernel setup, allocator growth and
+    // JIT compilation happen before the first real request.
+    void warmUp() {
+        if (options.warmupRounds <= 0) {
+            return;
+        }
+        cv::Mat blank = cv::Mat::zeros(preprocess::kSize, preprocess::kSize, CV_8UC3);
+        std::vector<const cv::Mat *> full(static_cast<size_t>(std::max(1, options.maxBatch)), &blank);
+        std::ostringstream oss;
+        oss << "Model warm-up run ms:";
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < options.warmupRounds; ++round) {
+            for (const auto &batch : {full, std::vector<const cv::Mat *>{&blank}}) {
+                auto runStart = std::chrono::steady_clock::now();
+                predictBatch(batch);
+                oss << " " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - runStart).count()
+                    << "(" << batch.size() << ")";
+            }
+        }
+        oss << ", total " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        logger.info(oss.str());
     }
 
-    std::vector<std::pair<std::string, float>> predictImage(const cv::Mat &image) {
-        // Preprocess image for the model
-        cv::Mat resized_image;
-        cv::resize(image, resized_image, cv::Size(224, 224));
-        resized_image.convertTo(resized_image, CV_32F, 1.0 / 255);
-
-        Tensor input_tensor(DT_FLOAT, TensorShape({ 1, 224, 224, 3 }));
-        std::copy(resized_image.data, resized_image.data + resized_image.total() * resized_image.elemSize(), input_tensor.flat<float>().data());
+    // Runs all images through the model as one {N, 224, 224, 3} tensor and
+    // splits the softmax rows back out per image.
+    std::vector<Predictions> predictBatch(const std::vector<const cv::Mat *> &images) {
+        const int64_t n = static_cast<int64_t>(images.size());
+        Tensor input_tensor(DT_FLOAT, TensorShape({ n, 224, 224, 3 }));
+        float *input = input_tensor.flat<float>().data();
+        for (int64_t i = 0; i < n; ++i) {
+            preprocess::toTensor(*images[i], options.normalization, input + i * preprocess::kSize * preprocess::kRowFloats);
+        }
 
         std::vector<Tensor> outputs;
+        auto start = std::chrono::steady_clock::now();
         Status status = session->Run({{"input_1", input_tensor}}, {"PredictionLayer/Softmax"}, {}, &outputs);
         if (!status.ok()) {
-            log("Error during prediction: " + status.ToString());
+            logger.error("Error during prediction: " + status.ToString());
             throw std::runtime_error("Prediction error.");
         }
+        runs.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(),
+                    images.size());
 
-        // Decode predictions
-        std::vector<std::pair<std::string, float>> predictions;
         auto output = outputs[0].flat<float>();
-        for (int i = 0; i < output.size(); ++i) {
-            predictions.emplace_back("Class " + std::to_string(i), output(i)); // Assuming class indices
+        const int64_t classes = output.size() / n;
+        std::vector<Predictions> results(images.size());
+        for (int64_t i = 0; i < n; ++i) {
+            results[i] = topK(output.data() + i * classes, classes, options.topK);
         }
-        return predictions;
+        return results;
     }
 
-    void saveImage(const cv::Mat &image, const std::string &output_dir, const std::string &label, const std::string &url) {
-        std::string label_dir = output_dir + "/" + label;
-        fs::create_directories(label_dir);
-        std::string image_filename = fs::path(url).filename().string();
-        std::string save_path = label_dir + "/" + image_filename;
-
-        cv::imwrite(save_path, image);
-        log("Image saved: " + save_path);
+    static std::string savePath(const std::string &output_dir, const std::string &label, const std::string &url) {
+        return output_dir + "/" + label + "/" + fs::path(url).filename().string();
     }
 
-    void logPredictions(const std::vector<std::pair<std::string, float>> &predictions) {
-        for (const auto &pred : predictions) {
-            log(pred.first + ": " + std::to_string(pred.second));
+};
+
+// Compares the fused kernel with the OpenCV chain it replaces (resize,
+// cvtColor, convertTo) on real images and reports per-image latency of both.
+int checkPreprocess(int count, char *paths[]) {
+    const int runs = 50;
+    const preprocess::Normalization norm;
+    std::vector<float> fused(preprocess::kSize * preprocess::kRowFloats);
+    bool ok = true;
+
+    for (int i = 0; i < count; ++i) {
+        cv::Mat image = cv::imread(paths[i], cv::IMREAD_COLOR);
+        if (image.empty()) {
+            std::cout << paths[i] << ": could not read" << std::endl;
+            ok = false;
+            continue;
         }
-    }
 
-    std::string currentDateTime() {
-        auto now = std::chrono::system_clock::now();
-        auto in_time_t = std::chrono::system_clock::to_time_t(now);
-        std::ostringstream oss;
-        oss << std::put_time(std::localtime(&in_time_t), "%Y-%m-%d %X");
-        return oss.str();
+        cv::Mat reference;
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < runs; ++r) {
+            cv::Mat resized, rgb;
+            cv::resize(image, resized, cv::Size(preprocess::kSize, preprocess::kSize));
+            cv::cvtColor(resized, rgb, cv::COLOR_BGR2RGB);
+            rgb.convertTo(reference, CV_32F, 1.0 / 255);
+        }
+        double opencvMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / runs;
+
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < runs; ++r) {
+            preprocess::toTensor(image, norm, fused.data());
+        }
+        double fusedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / runs;
+
+        float maxError = 0;
+        for (int y = 0; y < preprocess::kSize; ++y) {
+            const float *expected = reference.ptr<float>(y);
+            for (int x = 0; x < preprocess::kRowFloats; ++x) {
+                maxError = std::max(maxError, std::fabs(expected[x] - fused[y * preprocess::kRowFloats + x]));
+            }
+        }
+        bool pass = maxError <= preprocess::kTolerance + 1e-6f;
+        ok = ok && pass;
+        std::cout << paths[i] << " (" << image.cols << "x" << image.rows << "): max error " << maxError
+                  << (pass ? " ok" : " EXCEEDS TOLERANCE") << ", opencv " << opencvMs << " ms, fused " << fusedMs
+                  << " ms" << std::endl;
     }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    void initializeLog() {
-        std::ofstream logFile(log_file);
-        logFile << "Image processing started." << std::endl;
+// Parses "a,b,c" into three floats.
+void parseTriple(const std::string &value, float out[3]) {
+    std::istringstream iss(value);
+    std::string part;
+    for (int i = 0; i < 3; ++i) {
+        if (!std::getline(iss, part, ',')) {
+            throw std::invalid_argument("Expected three comma-separated values: " + value);
+        }
+        out[i] = std::stof(part);
     }
-};
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 5) {
-        std::cerr << "Usage: " << argv[0] << " <model_path> <image_urls_file> <output_dir> <log_file>" << std::endl;
+    if (argc > 2 && std::string(argv[1]) == "--check-preprocess") {
+        return checkPreprocess(argc - 2, argv + 2);
+    }
+    if (argc < 5) {
+        std::cerr << "Usage: " << argv[0] << " <model_path> <image_urls_file> <output_dir> <log_file>"
+                  << " [--connections N] [--decode-workers N] [--batch N] [--batch-wait-us N] [--queue-depth N]"
+                  << " [--reduced-decode] [--mean R,G,B] [--std R,G,B]"
+                  << " [--intra-op N] [--inter-op N] [--cpus A,B,...] [--no-graph-opt] [--xla] [--warmup N]"
+                  << " [--top-k N] [--labels FILE] [--predictions FILE] [--cache DIR] [--cache-entries N]"
+                  << " [--write-workers N] [--fsync-every N] [--host-rate N] [--host-burst N] [--retries N]"
+                  << std::endl;
         return EXIT_FAILURE;
     }
 
@@ -185,7 +1667,85 @@ int main(int argc, char *argv[]) {
         std::string output_dir = argv[3];
         std::string log_file = argv[4];
 
-        ImageProcessor processor(model_path, log_file);
+        PipelineOptions options;
+        options.decodeWorkers = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        for (int i = 5; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--reduced-decode") {
+                options.reducedDecode = true;
+                continue;
+            }
+            if (arg == "--no-graph-opt") {
+                options.graphOptimizer = false;
+                continue;
+            }
+            if (arg == "--xla") {
+                options.xlaJit = true;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            std::string value = argv[++i];
+            if (arg == "--connections") {
+                options.connections = std::stoi(value);
+            } else if (arg == "--decode-workers") {
+                options.decodeWorkers = std::stoi(value);
+            } else if (arg == "--batch") {
+                options.maxBatch = std::stoi(value);
+            } else if (arg == "--batch-wait-us") {
+                options.maxBatchWait = std::chrono::microseconds(std::stol(value));
+            } else if (arg == "--mean") {
+                parseTriple(value, options.normalization.mean);
+            } else if (arg == "--std") {
+                parseTriple(value, options.normalization.stddev);
+            } else if (arg == "--intra-op") {
+                options.intraOpThreads = std::stoi(value);
+            } else if (arg == "--inter-op") {
+                options.interOpThreads = std::stoi(value);
+            } else if (arg == "--cpus") {
+                std::istringstream iss(value);
+                std::string cpu;
+                while (std::getline(iss, cpu, ',')) {
+                    options.cpus.push_back(std::stoi(cpu));
+                }
+            } else if (arg == "--top-k") {
+                options.topK = std::stoi(value);
+            } else if (arg == "--labels") {
+                options.labelsPath = value;
+            } else if (arg == "--predictions") {
+                options.predictionsPath = value;
+            } else if (arg == "--cache") {
+                options.cacheDir = value;
+            } else if (arg == "--cache-entries") {
+                options.cacheEntries = std::stoul(value);
+            } else if (arg == "--write-workers") {
+                options.writeWorkers = std::stoi(value);
+            } else if (arg == "--fsync-every") {
+                options.fsyncEvery = std::stoul(value);
+            } else if (arg == "--host-rate") {
+                options.scheduler.hostRate = std::stod(value);
+                if (!(options.scheduler.hostRate >= 0)) {
+                    throw std::invalid_argument("--host-rate must not be negative");
+                }
+            } else if (arg == "--host-burst") {
+                options.scheduler.hostBurst = std::stod(value);
+                if (!(options.scheduler.hostBurst >= 1)) {
+                    throw std::invalid_argument("--host-burst must be at least 1");
+                }
+            } else if (arg == "--retries") {
+                options.scheduler.maxRetries = std::stoi(value);
+            } else if (arg == "--warmup") {
+                options.warmupRounds = std::stoi(value);
+            } else if (arg == "--queue-depth") {
+                options.queueDepth = std::stoul(value);
+            } else {
+                throw std::invalid_argument("Unknown option: " + arg);
+            }
+        }
+
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        ImageProcessor processor(model_path, log_file, options);
         processor.processImages(image_urls_file, output_dir);
 
     } catch (const std::exception &e) {
@@ -193,5 +1753,6 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    curl_global_cleanup();
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace kickai {
+
+enum class LogLevel { Debug = 0, Info = 1, Warn = 2, Error = 3 };
+
+inline const char *levelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::Debug: return "DEBUG";
+    case LogLevel::Info: return "INFO";
+    case LogLevel::Warn: return "WARN";
+    default: return "ERROR";
+    }
+}
+
+inline LogLevel parseLogLevel(const std::string &name) {
+    if (name == "debug") return LogLevel::Debug;
+    if (name == "info") return LogLevel::Info;
+    if (name == "warn") return LogLevel::Warn;
+    if (name == "error") return LogLevel::Error;
+    throw std::invalid_argument("Unknown log level: " + name);
+}
+
+// Asynchronous file logger shared by the kickAI tools.
+//
+// Producers push messages into a bounded lock-free MPSC ring (Vyukov-style
+// per-slot sequence numbers) and return without touching the file. A single
+// flusher thread drains the ring, formats timestamps from a per-second cache
+// and writes whole batches with one fwrite. When the ring is full producers
+// yield until a slot frees up, so messages are never dropped.
+class Logger {
+public:
+    explicit Logger(const std::string &path, LogLevel minLevel = LogLevel::Info, bool truncate = false,
+                    size_t capacity = 8192)
+        : minLevel(static_cast<int>(minLevel)), mask(roundUpPow2(capacity) - 1),
+          slots(new Slot[mask + 1]) {
+        file = std::fopen(path.c_str(), truncate ? "w" : "a");
+        if (!file) {
+            throw std::runtime_error("Could not open log file: " + path);
+        }
+        for (size_t i = 0; i <= mask; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        flusher = std::thread([this] { run(); });
+    }
+
+    ~Logger() {
+        stopping.store(true);
+        wakeFlusher();
+        flusher.join();
+        std::fclose(file);
+    }
+
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+
+    void setLevel(LogLevel level) { minLevel.store(static_cast<int>(level), std::memory_order_relaxed); }
+
+    // Lets callers skip building a message that would be filtered out.
+    bool enabled(LogLevel level) const {
+        return static_cast<int>(level) >= minLevel.load(std::memory_order_relaxed);
+    }
+
+    void log(LogLevel level, std::string message) {
+        if (!enabled(level)) {
+            return;
+        }
+        auto now = std::chrono::system_clock::now();
+
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Slot *slot;
+        for (;;) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // Full: wait for the flusher to free this slot.
+                wakeFlusher();
+                std::this_thread::yield();
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        slot->level = level;
+        slot->time = now;
+        slot->text = std::move(message);
+        // seq_cst pairs with the flusher's idle store/re-check so a wake-up is
+        // never missed.
+        slot->sequence.store(pos + 1, std::memory_order_seq_cst);
+        if (flusherIdle.load(std::memory_order_seq_cst)) {
+            wakeFlusher();
+        }
+    }
+
+    void debug(std::string message) { log(LogLevel::Debug, std::move(message)); }
+    void info(std::string message) { log(LogLevel::Info, std::move(message)); }
+    void warn(std::string message) { log(LogLevel::Warn, std::move(message)); }
+    void error(std::string message) { log(LogLevel::Error, std::move(message)); }
+
+    // Blocks until every message logged before the call is on disk.
+    void flush() {
+        size_t target = enqueuePos.load(std::memory_order_acquire);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (written.load(std::memory_order_acquire) < target) {
+            wakeFlusherLocked();
+            drained.wait_for(lock, std::chrono::milliseconds(1));
+        }
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        LogLevel level;
+        std::chrono::system_clock::time_point time;
+        std::string text;
+    };
+
+    std::atomic<int> minLevel;
+    const size_t mask;
+    std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<size_t> enqueuePos{0};
+    alignas(64) size_t dequeuePos = 0; // flusher only
+    std::atomic<size_t> written{0};
+    std::atomic<bool> flusherIdle{false};
+    std::atomic<bool> stopping{false};
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    std::FILE *file;
+    std::thread flusher;
+
+    // Timestamp text is rebuilt only when the second changes.
+    std::time_t cachedSecond = -1;
+    char cachedStamp[32] = {};
+
+    static size_t roundUpPow2(size_t n) {
+        size_t p = 2;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    void wakeFlusher() {
+        std::lock_guard<std::mutex> lock(mutex);
+        wakeFlusherLocked();
+    }
+
+    void wakeFlusherLocked() { wake.notify_one(); }
+
+    const char *stamp(std::chrono::system_clock::time_point time) {
+        std::time_t second = std::chrono::system_clock::to_time_t(time);
+        if (second != cachedSecond) {
+            std::tm tm;
+            localtime_r(&second, &tm);
+            std::strftime(cachedStamp, sizeof(cachedStamp), "%Y-%m-%d %X", &tm);
+            cachedSecond = second;
+        }
+        return cachedStamp;
+    }
+
+    static constexpr size_t kMaxBatch = 1024;
+
+    // Moves up to kMaxBatch published messages into batch; returns how many.
+    size_t drain(std::string &batch) {
+        size_t count = 0;
+        while (count < kMaxBatch) {
+            Slot &slot = slots[dequeuePos & mask];
+            if (slot.sequence.load(std::memory_order_acquire) != dequeuePos + 1) {
+                return count;
+            }
+            batch += stamp(slot.time);
+            batch += " [";
+            batch += levelName(slot.level);
+            batch += "] ";
+            batch += slot.text;
+            batch += '\n';
+            slot.text.clear();
+            slot.sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+            ++dequeuePos;
+            ++count;
+        }
+        return count;
+    }
+
+    void run() {
+        std::string batch;
+        for (;;) {
+            batch.clear();
+            if (drain(batch) > 0) {
+                std::fwrite(batch.data(), 1, batch.size(), file);
+                std::fflush(file);
+                written.store(dequeuePos, std::memory_order_release);
+                drained.notify_all();
+                continue;
+            }
+            if (stopping.load()) {
+                return;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            flusherIdle.store(true, std::memory_order_seq_cst);
+            // Re-check after announcing idleness so a producer that missed the
+            // flag cannot leave a message stranded.
+            if (slots[dequeuePos & mask].sequence.load(std::memory_order_seq_cst) != dequeuePos + 1 &&
+                !stopping.load()) {
+                wake.wait_for(lock, std::chrono::milliseconds(50));
+            }
+            flusherIdle.store(false, std::memory_order_relaxed);
+        }
+    }
+};
+
+} // namespace kickai
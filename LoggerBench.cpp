@@ -0,0 +1,42 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include "Logger.h"
+
+// Measures kickai::Logger throughput: every thread logs the same number of
+// messages and the rate counts the time until the last one is on disk.
+int main(int argc, char *argv[]) {
+    const int messagesPerThread = argc > 1 ? std::stoi(argv[1]) : 200000;
+    const std::string path = "logger_bench.log";
+
+    unsigned maxThreads = std::max(2u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        double seconds;
+        {
+            kickai::Logger logger(path, kickai::LogLevel::Info, true);
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::thread> producers;
+            for (unsigned t = 0; t < threads; ++t) {
+                producers.emplace_back([&logger, t, messagesPerThread] {
+                    for (int i = 0; i < messagesPerThread; ++i) {
+                        logger.info("thread " + std::to_string(t) + " message " + std::to_string(i));
+                        // Filtered messages should cost almost nothing.
+                        logger.debug("filtered");
+                    }
+                });
+            }
+            for (auto &producer : producers) {
+                producer.join();
+            }
+            logger.flush();
+            seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        double total = static_cast<double>(threads) * messagesPerThread;
+        std::cout << threads << " threads: " << total / seconds / 1e6 << " M messages/s" << std::endl;
+    }
+    std::remove(path.c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+#!/usr/bin/env bash
+# Offline check of image_downloader paging and resume.
+#
+# Serves the canned result pages in testdata/search_pages (four links, four,
+# three, then an empty page) and their images through fault_server.py, then
+# crawls them in three runs against one save directory:
+#
+#   1. 6 images: pages 0 and 1 are read, images 0-5 saved.
+#   2. 10 images: resumes from the manifest; only page 2 and images 6-9 are
+#      fetched.
+#   3. 20 images: only image 10 and the empty page 3 are fetched; the crawl
+#      stops at the end of the results with 11 images.
+#
+#   ./check_crawl.sh [path/to/image_downloader]
+#
+# FAULT_RATE (default 0) injects 429/500/dropped responses; the checks count
+# successful responses only, so they hold with retries too.
+
+set -eu
+
+here=$(cd "$(dirname "$0")" && pwd)
+downloader=$(realpath "${1:-./image_downloader}")
+port=${PORT:-18765}
+base="http://127.0.0.1:$port"
+work=$(mktemp -d)
+server=
+
+cleanup() {
+    if [ -n "$server" ]; then
+        kill "$server" 2>/dev/null || true
+        wait "$server" 2>/dev/null || true
+    fi
+    rm -rf "$work"
+}
+trap cleanup EXIT
+
+mkdir -p "$work/www/images" "$work/crawl"
+for page in "$here"/testdata/search_pages/page*.json; do
+    sed "s#@BASE@#$base#g" "$page" > "$work/www/$(basename "$page")"
+done
+for i in $(seq 0 10); do
+    { echo "image $i"; head -c 2048 /dev/urandom; } > "$work/www/images/$i.jpg"
+done
+
+python3 "$here/fault_server.py" --port "$port" --root "$work/www" --fault-rate "${FAULT_RATE:-0}" \
+    --delay-ms 0 > "$work/server.log" 2>&1 &
+server=$!
+for _ in $(seq 50); do
+    curl -sf "$base/stats" > /dev/null && break
+    sleep 0.1
+done
+
+served() {
+    curl -sf "$base/stats" | python3 -c 'import json, sys; print(json.load(sys.stdin)["served"])'
+}
+
+failures=0
+check() { # description expected actual
+    if [ "$2" = "$3" ]; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1: expected $2, got $3"
+        failures=$((failures + 1))
+    fi
+}
+
+# crawl <images>: runs the downloader and prints how many responses it used.
+crawl() {
+    local before
+    before=$(served)
+    (cd "$work" && "$downloader" nature crawl "$1" --concurrency 2 --search-url "$base/page{page}.json" \
+        --max-pages 10 --retries 8 > /dev/null)
+    echo $(($(served) - before))
+}
+
+saved() {
+    (cd "$work/crawl" && ls nature_*.jpg 2>/dev/null | sort -t_ -k2 -n | tr '\n' ' ' | sed 's/ $//')
+}
+
+check "first run: 2 pages + 6 images fetched" 8 "$(crawl 6)"
+check "first run: links 0-5 saved, numbered from 1" \
+    "nature_1.jpg nature_2.jpg nature_3.jpg nature_4.jpg nature_5.jpg nature_6.jpg" "$(saved)"
+check "first run: manifest knows pages 0-1" "0 1" "$(grep '^page ' "$work/crawl/.manifest" | cut -d' ' -f2 | xargs)"
+
+check "resumed run: 1 page + 4 images fetched" 5 "$(crawl 10)"
+check "resumed run: picked up from the manifest" 1 \
+    "$(grep -c 'Resuming: 6 of 8 known images' "$work/image_downloader.log")"
+check "resumed run: 10 images saved" 10 "$(saved | wc -w)"
+
+check "final run: empty page + 1 image fetched" 2 "$(crawl 20)"
+check "final run: all 11 images saved" 11 "$(saved | wc -w)"
+check "final run: every link done" 11 "$(grep -c '^done ' "$work/crawl/.manifest")"
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures check(s) failed; downloader log:"
+    cat "$work/image_downloader.log"
+    exit 1
+fi
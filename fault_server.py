@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Fault-injecting HTTP stand-in for exercising the downloaders offline.
+
+Serves files from a directory over HTTP/1.1 keep-alive and, with the given
+probability per request, answers instead with one of:
+
+  - 429 with a Retry-After header,
+  - 500,
+  - a 200 whose body stops short and whose connection is then closed.
+
+GET /stats returns the counters as JSON. Faults are drawn from a seeded
+generator, so a run is repeatable up to thread scheduling.
+
+    python3 fault_server.py --port 8000 --root ./images --fault-rate 0.3
+    ./image_downloader q out 50 --search-url 'http://127.0.0.1:8000/page{page}.json'
+"""
+
+import argparse
+import functools
+import http.server
+import json
+import random
+import socketserver
+import threading
+import time
+
+
+class Faults:
+    def __init__(self, rate, seed, retry_after, delay):
+        self.rate = rate
+        self.retry_after = retry_after
+        self.delay = delay
+        self.random = random.Random(seed)
+        self.lock = threading.Lock()
+        self.inflight = 0
+        self.stats = {"requests": 0, "served": 0, "throttled": 0, "server_errors": 0, "dropped": 0,
+                      "max_inflight": 0}
+
+    def begin(self):
+        """Counts a request in and picks its fault, or None."""
+        with self.lock:
+            self.stats["requests"] += 1
+            self.inflight += 1
+            self.stats["max_inflight"] = max(self.stats["max_inflight"], self.inflight)
+            draw = self.random.random()
+        if draw >= self.rate:
+            return None
+        return ("throttled", "server_errors", "dropped")[min(2, int(3 * draw / self.rate))]
+
+    def end(self, outcome):
+        with self.lock:
+            self.inflight -= 1
+            self.stats[outcome] += 1
+
+    def snapshot(self):
+        with self.lock:
+            return dict(self.stats)
+
+
+class Handler(http.server.SimpleHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def __init__(self, *args, faults, **kwargs):
+        self.faults = faults
+        super().__init__(*args, **kwargs)
+
+    def do_GET(self):
+        if self.path == "/stats":
+            self.reply(200, json.dumps(self.faults.snapshot()).encode(), "application/json")
+            return
+        fault = self.faults.begin()
+        try:
+            time.sleep(self.faults.delay)
+            if fault == "throttled":
+                self.reply(429, b"", extra={"Retry-After": str(self.faults.retry_after)})
+            elif fault == "server_errors":
+                self.reply(500, b"")
+            elif fault == "dropped":
+                self.send_response(200)
+                self.send_header("Content-Length", "100000")
+                self.end_headers()
+                self.wfile.write(b"x" * 10)
+                self.close_connection = True
+            else:
+                super().do_GET()
+        finally:
+            self.faults.end(fault or "served")
+
+    def reply(self, status, body, content_type="text/plain", extra=None):
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        for name, value in (extra or {}).items():
+            self.send_header(name, value)
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, *args):
+        pass
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--root", default=".", help="directory to serve")
+    parser.add_argument("--fault-rate", type=float, default=0.3, help="probability of a fault per request")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--retry-after", type=int, default=1, help="seconds sent with 429")
+    parser.add_argument("--delay-ms", type=float, default=20, help="latency added to every request")
+    args = parser.parse_args()
+
+    faults = Faults(args.fault_rate, args.seed, args.retry_after, args.delay_ms / 1000)
+    handler = functools.partial(Handler, faults=faults, directory=args.root)
+    server = Server(("127.0.0.1", args.port), handler)
+    print(f"Serving {args.root} on http://127.0.0.1:{args.port}/ with fault rate {args.fault_rate}", flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print(json.dumps(faults.snapshot()), flush=True)
+
+
+if __name__ == "__main__":
+    main()
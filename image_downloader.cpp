@@ -4,85 +4,874 @@
 #include <sstream>
 #include <curl/curl.h>
 #include <nlohmann/json.hpp>
+#include <opencv2/opencv.hpp>
+#include <openssl/evp.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+#include <cerrno>
+#include <cstdio>
 #include <vector>
 #include <stdexcept>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include "Logger.h"
+#include "BoundedQueue.h"
+#include "FetchScheduler.h"
 
 using json = nlohmann::json;
 
+struct DownloadOptions {
+    int concurrency = 8;   // transfers in flight at once
+    int perHost = 4;       // connections per host; HTTP/2 streams share them
+    bool http2 = true;     // negotiate HTTP/2 over TLS and multiplex on it
+    // Search endpoint; {query} and {page} are substituted. Without {page}
+    // only one page is read.
+    std::string searchUrl = "https://yandex.com/images/search?text={query}&format=json&p={page}";
+    int maxPages = 1000;   // stop paging after this many result pages
+    size_t linkQueue = 1024; // discovered links waiting for a download slot
+    bool dedup = true;     // drop exact and near-duplicate images before saving
+    int dedupDistance = 6; // dHash bits that may differ for a near duplicate (at most 11); -1 for exact only
+    kickai::SchedulerOptions scheduler; // rate limits and retries; maxConcurrency comes from concurrency
+};
+
+struct ImageLink {
+    size_t index; // position in discovery order; names the saved file
+    std::string url;
+};
+
+// Pulls items[].image.url out of a search result page as the parser goes,
+// without building a DOM for the whole page.
+class LinkCollector : public nlohmann::json_sax<json> {
+public:
+    std::vector<std::string> urls;
+
+    bool null() override { return true; }
+    bool boolean(bool) override { return true; }
+    bool number_integer(number_integer_t) override { return true; }
+    bool number_unsigned(number_unsigned_t) override { return true; }
+    bool number_float(number_float_t, const string_t&) override { return true; }
+    bool binary(binary_t&) override { return true; }
+
+    bool string(string_t& value) override {
+        // Path: {"items": [ {"image": {"url": <value>}} ]}
+        if (path.size() == 4 && path[0].key == "items" && path[1].array && path[2].key == "image" &&
+            path[3].key == "url") {
+            urls.push_back(std::move(value));
+        }
+        return true;
+    }
+
+    bool start_object(std::size_t) override {
+        path.push_back({false, {}});
+        return true;
+    }
+    bool key(string_t& name) override {
+        path.back().key = name;
+        return true;
+    }
+    bool end_object() override {
+        path.pop_back();
+        return true;
+    }
+    bool start_array(std::size_t) override {
+        path.push_back({true, {}});
+        return true;
+    }
+    bool end_array() override {
+        path.pop_back();
+        return true;
+    }
+
+    bool parse_error(std::size_t position, const std::string&, const nlohmann::detail::exception& e) override {
+        error = "at byte " + std::to_string(position) + ": " + e.what();
+        return false;
+    }
+
+    std::string error;
+
+private:
+    struct Level {
+        bool array;
+        std::string key; // current key, for objects
+    };
+    std::vector<Level> path;
+};
+
+// Append-only record of a crawl, one event per line:
+//   query <text>        first line; a different query starts a new manifest
+//   link <index> <url>  a discovered link
+//   page <n>            page n was read completely
+//   done <index>        link <index> is saved
+// Reloading it yields the links still to download and the next page to
+// read, so an interrupted crawl resumes without re-fetching either.
+class CrawlManifest {
+public:
+    CrawlManifest(const std::string& path, const std::string& query) {
+        load(path, query);
+        file = std::fopen(path.c_str(), fresh ? "w" : "a");
+        if (!file) {
+            throw std::runtime_error("Could not open manifest " + path);
+        }
+        if (fresh) {
+            std::fprintf(file, "query %s\n", query.c_str());
+            std::fflush(file);
+        }
+    }
+
+    ~CrawlManifest() {
+        std::fclose(file);
+    }
+
+    CrawlManifest(const CrawlManifest&) = delete;
+    CrawlManifest& operator=(const CrawlManifest&) = delete;
+
+    // Known links below limit that are not saved yet.
+    std::vector<ImageLink> pending(size_t limit) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<ImageLink> result;
+        for (size_t i = 0; i < std::min(limit, links.size()); ++i) {
+            if (!done[i]) {
+                result.push_back({i, links[i]});
+            }
+        }
+        return result;
+    }
+
+    size_t linkCount() const { return links.size(); }
+    size_t doneCount() const { return completed; }
+    int nextPage() const { return pagesRead; }
+
+    // Records a whole page of links; returns them numbered.
+    std::vector<ImageLink> addPage(int page, const std::vector<std::string>& urls) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<ImageLink> added;
+        for (const auto& url : urls) {
+            added.push_back({links.size(), url});
+            std::fprintf(file, "link %zu %s\n", links.size(), url.c_str());
+            links.push_back(url);
+            done.push_back(false);
+        }
+        std::fprintf(file, "page %d\n", page);
+        std::fflush(file);
+        pagesRead = page + 1;
+        return added;
+    }
+
+    void markDone(size_t index) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::fprintf(file, "done %zu\n", index);
+        // A crash loses at most a few done records, which only costs
+        // re-downloading those images.
+        if (++unflushed >= 64) {
+            std::fflush(file);
+            unflushed = 0;
+        }
+        ++completed;
+    }
+
+private:
+    std::FILE* file = nullptr;
+    std::mutex mutex;
+    bool fresh = true;
+    std::vector<std::string> links; // by index; only grows at page boundaries
+    std::vector<bool> done;
+    size_t completed = 0;
+    int pagesRead = 0;
+    int unflushed = 0;
+
+    void load(const std::string& path, const std::string& query) {
+        std::ifstream in(path);
+        std::string line;
+        if (!in.is_open() || !std::getline(in, line) || line != "query " + query) {
+            return;
+        }
+        fresh = false;
+        // Links count only once their page is complete; a page cut short is
+        // read again.
+        size_t committedLinks = 0;
+        while (std::getline(in, line)) {
+            std::istringstream iss(line);
+            std::string kind;
+            iss >> kind;
+            if (kind == "link") {
+                // The URL is the rest of the line; it may contain spaces.
+                size_t index;
+                std::string url;
+                if (iss >> index && std::getline(iss >> std::ws, url) && !url.empty() && index == links.size()) {
+                    links.push_back(url);
+                    done.push_back(false);
+                }
+            } else if (kind == "page") {
+                iss >> pagesRead;
+                ++pagesRead;
+                committedLinks = links.size();
+            } else if (kind == "done") {
+                size_t index;
+                if (iss >> index && index < done.size() && !done[index]) {
+                    done[index] = true;
+                    ++completed;
+                }
+            }
+        }
+        links.resize(committedLinks);
+        done.resize(committedLinks);
+        completed = static_cast<size_t>(std::count(done.begin(), done.end(), true));
+    }
+};
+
+// Multi-index hashing over 64-bit perceptual hashes under Hamming distance.
+// Each hash is split into four 16-bit chunks with one table per chunk. Two
+// hashes within r bits must agree to within r/4 bits on at least one chunk
+// (pigeonhole), so a lookup probes every chunk value within r/4 flips (17
+// probes per chunk for r < 8) and verifies the few candidates found there.
+// Lookups stay in the microseconds at millions of entries, where a BK-tree
+// ends up visiting most of the tree.
+class MultiIndexHash {
+public:
+    MultiIndexHash() {
+        for (auto& table : tables) {
+            table.resize(1 << 16);
+        }
+    }
+
+    void insert(uint64_t hash, uint32_t id) {
+        for (int chunk = 0; chunk < kChunks; ++chunk) {
+            tables[chunk][part(hash, chunk)].push_back(static_cast<uint32_t>(hashes.size()));
+        }
+        hashes.push_back(hash);
+        ids.push_back(id);
+    }
+
+    // Any indexed hash within maxDistance of hash.
+    bool findWithin(uint64_t hash, int maxDistance, uint32_t& id, int& distance) const {
+        const int radius = std::min(maxDistance, kMaxDistance) / kChunks;
+        for (int chunk = 0; chunk < kChunks; ++chunk) {
+            if (probe(hash, maxDistance, chunk, part(hash, chunk), 0, radius, id, distance)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t size() const { return hashes.size(); }
+
+    // Beyond this the probe count per chunk grows past a few thousand.
+    static constexpr int kMaxDistance = 11;
+
+private:
+    static constexpr int kChunks = 4;
+
+    std::vector<std::vector<uint32_t>> tables[kChunks]; // chunk value -> positions in hashes
+    std::vector<uint64_t> hashes;
+    std::vector<uint32_t> ids;
+
+    static uint16_t part(uint64_t hash, int chunk) { return static_cast<uint16_t>(hash >> (16 * chunk)); }
+
+    // Visits value and every variant with up to flips more bits flipped at
+    // positions from firstBit on.
+    bool probe(uint64_t hash, int maxDistance, int chunk, uint16_t value, int firstBit, int flips, uint32_t& id,
+               int& distance) const {
+        for (uint32_t position : tables[chunk][value]) {
+            int d = __builtin_popcountll(hash ^ hashes[position]);
+            if (d <= maxDistance) {
+                id = ids[position];
+                distance = d;
+                return true;
+            }
+        }
+        if (flips == 0) {
+            return false;
+        }
+        for (int bit = firstBit; bit < 16; ++bit) {
+            if (probe(hash, maxDistance, chunk, static_cast<uint16_t>(value ^ (1u << bit)), bit + 1, flips - 1, id,
+                      distance)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// 64-bit difference hash: the image shrunk to 9x8 luma, one bit per
+// horizontally adjacent pair (left brighter than right). Robust to
+// rescaling and recompression. Returns false if the file is not an image.
+inline bool differenceHash(const std::string& path, uint64_t& hash) {
+    // A quarter-scale decode is plenty for an 9x8 thumbnail.
+    cv::Mat image = cv::imread(path, cv::IMREAD_REDUCED_COLOR_4);
+    if (image.empty()) {
+        return false;
+    }
+    cv::Mat small;
+    cv::resize(image, small, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+    hash = 0;
+    for (int y = 0; y < 8; ++y) {
+        const uchar* row = small.ptr<uchar>(y);
+        for (int x = 0; x < 8; ++x) {
+            const uchar* a = row + x * 3;
+            const uchar* b = a + 3;
+            int left = a[0] + 2 * a[1] + a[2];
+            int right = b[0] + 2 * b[1] + b[2];
+            hash = (hash << 1) | (left > right ? 1u : 0u);
+        }
+    }
+    return true;
+}
+
+// Exact (SHA-256) and near (dHash within maxDistance bits) duplicate index.
+// Unique images are appended to <saveDir>/.dedup as "<sha256> <dhash|->
+// <name>" so later runs of the same crawl keep deduplicating against them.
+class DedupIndex {
+public:
+    enum class Verdict { Unique, Exact, Near };
+
+    DedupIndex(const std::string& path, int maxDistance)
+        : maxDistance(std::min(maxDistance, MultiIndexHash::kMaxDistance)) {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            // The name is the rest of the line; it may contain spaces.
+            std::istringstream iss(line);
+            std::string sha, dhash, name;
+            if (iss >> sha >> dhash && std::getline(iss >> std::ws, name) && !name.empty()) {
+                remember(sha, dhash != "-", std::strtoull(dhash.c_str(), nullptr, 16), name);
+            }
+        }
+        file = std::fopen(path.c_str(), "a");
+        if (!file) {
+            throw std::runtime_error("Could not open dedup index " + path);
+        }
+    }
+
+    ~DedupIndex() {
+        std::fclose(file);
+    }
+
+    DedupIndex(const DedupIndex&) = delete;
+    DedupIndex& operator=(const DedupIndex&) = delete;
+
+    // Looks the image up; original names the earlier image for duplicates.
+    // Unique images are indexed with add() once they are saved.
+    Verdict check(const std::string& sha, bool hasHash, uint64_t dhash, std::string& original) {
+        auto start = std::chrono::steady_clock::now();
+        Verdict verdict = Verdict::Unique;
+        auto exact = bySha.find(sha);
+        uint32_t id = 0;
+        int distance = 0;
+        if (exact != bySha.end()) {
+            verdict = Verdict::Exact;
+            original = names[exact->second];
+        } else if (hasHash && maxDistance >= 0 && perceptual.findWithin(dhash, maxDistance, id, distance)) {
+            verdict = Verdict::Near;
+            original = names[id];
+        }
+        lookupMicros.push_back(
+            std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        ++(verdict == Verdict::Unique ? unique : verdict == Verdict::Exact ? exactDuplicates : nearDuplicates);
+        return verdict;
+    }
+
+    void add(const std::string& sha, bool hasHash, uint64_t dhash, const std::string& name) {
+        remember(sha, hasHash, dhash, name);
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(dhash));
+        std::fprintf(file, "%s %s %s\n", sha.c_str(), hasHash ? hex : "-", name.c_str());
+        std::fflush(file);
+    }
+
+    std::string report() const {
+        size_t checked = unique + exactDuplicates + nearDuplicates;
+        std::ostringstream oss;
+        oss << "Dedup: " << exactDuplicates << " exact and " << nearDuplicates << " near duplicates of " << checked
+            << " images (" << (checked ? 100.0 * (exactDuplicates + nearDuplicates) / checked : 0.0) << "% dropped), "
+            << names.size() << " indexed";
+        if (!lookupMicros.empty()) {
+            std::vector<double> sorted = lookupMicros;
+            std::sort(sorted.begin(), sorted.end());
+            auto percentile = [&](double p) {
+                return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+            };
+            oss << ", lookup us p50 " << percentile(0.50) << " p99 " << percentile(0.99) << " max " << sorted.back();
+        }
+        return oss.str();
+    }
+
+private:
+    int maxDistance;
+    std::FILE* file = nullptr;
+    std::unordered_map<std::string, uint32_t> bySha;
+    std::vector<std::string> names; // by id
+    MultiIndexHash perceptual;
+    size_t unique = 0, exactDuplicates = 0, nearDuplicates = 0;
+    std::vector<double> lookupMicros;
+
+    void remember(const std::string& sha, bool hasHash, uint64_t dhash, const std::string& name) {
+        uint32_t id = static_cast<uint32_t>(names.size());
+        names.push_back(name);
+        bySha.emplace(sha, id);
+        if (hasHash) {
+            perceptual.insert(dhash, id);
+        }
+    }
+};
+
 class ImageDownloader {
 public:
-    ImageDownloader(const std::string& query, const std::string& saveDir, int numImages = 10)
-        : query(query), saveDir(saveDir), numImages(numImages) {
+    ImageDownloader(const std::string& query, const std::string& saveDir, int numImages = 10,
+                    const DownloadOptions& options = DownloadOptions())
+        : query(query), saveDir(saveDir), numImages(numImages), options(options),
+          scheduler(schedulerOptions(options)) {
         createDirectory(saveDir);
-        fetchImageLinks();
     }
 
+    ~ImageDownloader() {
+        for (CURL* curl : idleHandles) {
+            curl_easy_cleanup(curl);
+        }
+        if (multi) {
+            curl_multi_cleanup(multi);
+        }
+    }
+
+    ImageDownloader(const ImageDownloader&) = delete;
+    ImageDownloader& operator=(const ImageDownloader&) = delete;
+
+    // Pages through the search results on a producer thread while up to
+    // options.concurrency transfers run on one multi handle, so downloads
+    // start as soon as the first page is in. Easy handles and their
+    // connections are kept for reuse, so each host costs one TCP+TLS
+    // handshake per connection rather than one per image. Progress goes to
+    // <saveDir>/.manifest; a rerun picks up where an interrupted one stopped.
     void downloadImages() {
-        for (size_t i = 0; i < imageLinks.size() && i < numImages; ++i) {
-            downloadImage(imageLinks[i], query + "_" + std::to_string(i + 1) + ".jpg");
+        const size_t limit = static_cast<size_t>(std::max(0, numImages));
+        CrawlManifest manifest(saveDir + "/.manifest", query);
+        if (manifest.doneCount() > 0) {
+            log("Resuming: " + std::to_string(manifest.doneCount()) + " of " + std::to_string(manifest.linkCount()) +
+                " known images already saved.");
+        }
+        // Anything that can throw goes before the producer starts: unwinding
+        // past a joinable std::thread terminates the process.
+        std::unique_ptr<DedupIndex> dedup;
+        if (options.dedup) {
+            dedup = std::make_unique<DedupIndex>(saveDir + "/.dedup", options.dedupDistance);
+        }
+        kickai::BoundedQueue<ImageLink> links(options.linkQueue);
+        CURLM* multi = multiHandle();
+        std::thread producer([&] { produceLinks(links, manifest, limit); });
+
+        // Hashing and the duplicate check read the finished file, so they run
+        // on their own thread to keep the transfer loop responsive.
+        kickai::BoundedQueue<std::unique_ptr<Transfer>> finished(static_cast<size_t>(std::max(1, options.concurrency)) * 2);
+        std::thread finisher;
+        std::atomic<size_t> saved{0};
+        if (dedup) {
+            finisher = std::thread([&] {
+                std::unique_ptr<Transfer> transfer;
+                while (finished.pop(transfer)) {
+                    saved += finish(*transfer, manifest, dedup.get()) ? 1 : 0;
+                    transfer.reset();
+                }
+            });
+        }
+
+        size_t started = 0;
+        std::unordered_map<CURL*, std::unique_ptr<Transfer>> active;
+        // Links waiting for a host token or a retry, earliest first.
+        std::vector<Delayed> delayed;
+        const size_t maxDelayed = static_cast<size_t>(std::max(1, options.concurrency)) * 4;
+        auto start = std::chrono::steady_clock::now();
+        bool moreLinks = true;
+
+        while (moreLinks || !active.empty() || !delayed.empty()) {
+            auto now = kickai::FetchScheduler::Clock::now();
+            while (active.size() < static_cast<size_t>(scheduler.concurrency())) {
+                Delayed next;
+                if (!delayed.empty() && delayed.front().readyAt <= now) {
+                    std::pop_heap(delayed.begin(), delayed.end(), laterFirst);
+                    next = std::move(delayed.back());
+                    delayed.pop_back();
+                } else if (!moreLinks || delayed.size() >= maxDelayed) {
+                    break;
+                } else if (active.empty() && delayed.empty()) {
+                    // Nothing else to do: wait for the producer.
+                    if (!links.pop(next.link)) {
+                        moreLinks = false;
+                        break;
+                    }
+                } else if (!links.tryPop(next.link)) {
+                    break;
+                }
+                kickai::FetchScheduler::Clock::time_point retryAt;
+                if (!scheduler.tryAcquire(next.link.url, now, retryAt)) {
+                    next.readyAt = retryAt;
+                    delayed.push_back(std::move(next));
+                    std::push_heap(delayed.begin(), delayed.end(), laterFirst);
+                    continue;
+                }
+                const ImageLink& link = next.link;
+                if (next.attempt == 0) {
+                    ++started;
+                }
+                auto transfer = std::make_unique<Transfer>();
+                transfer->attempt = next.attempt;
+                transfer->started = now;
+                transfer->index = link.index;
+                transfer->url = link.url;
+                transfer->outputName = query + "_" + std::to_string(link.index + 1) + ".jpg";
+                transfer->finalPath = saveDir + "/" + transfer->outputName;
+                transfer->tempPath = saveDir + "/." + transfer->outputName + ".part";
+                transfer->fd = ::open(transfer->tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                if (transfer->fd < 0) {
+                    logger.error("Error downloading image: could not create " + transfer->tempPath);
+                    continue;
+                }
+                if (options.dedup) {
+                    transfer->sha = EVP_MD_CTX_new();
+                    if (!transfer->sha || EVP_DigestInit_ex(transfer->sha, EVP_sha256(), nullptr) != 1) {
+                        logger.error("Error downloading image: could not start SHA-256");
+                        continue;
+                    }
+                }
+                CURL* curl = acquireHandle(transfer->url);
+                if (!curl) {
+                    logger.error("Error downloading image: could not create a transfer for " + transfer->url);
+                    continue;
+                }
+                curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, fileWriteCallback);
+                curl_easy_setopt(curl, CURLOPT_WRITEDATA, transfer.get());
+                curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, fileHeaderCallback);
+                curl_easy_setopt(curl, CURLOPT_HEADERDATA, transfer.get());
+                curl_multi_add_handle(multi, curl);
+                active.emplace(curl, std::move(transfer));
+            }
+
+            int running = 0;
+            curl_multi_perform(multi, &running);
+
+            int queued = 0;
+            while (CURLMsg* msg = curl_multi_info_read(multi, &queued)) {
+                if (msg->msg != CURLMSG_DONE) {
+                    continue;
+                }
+                CURL* curl = msg->easy_handle;
+                CURLcode res = msg->data.result;
+                long status = 0;
+                curl_off_t retryAfter = 0;
+                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+                curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retryAfter);
+                curl_multi_remove_handle(multi, curl);
+                idleHandles.push_back(curl);
+
+                auto transfer = std::move(active[curl]);
+                active.erase(curl);
+                auto outcome = kickai::FetchScheduler::classify(res == CURLE_OK, status);
+                auto finishedAt = kickai::FetchScheduler::Clock::now();
+                double serverDelay = retryAfter > 0 ? static_cast<double>(retryAfter) : -1;
+                scheduler.record(transfer->url, outcome, finishedAt - transfer->started, serverDelay);
+                std::string failure = res != CURLE_OK ? curl_easy_strerror(res) : "HTTP " + std::to_string(status);
+                if (outcome != kickai::FetchScheduler::Outcome::Success &&
+                    scheduler.shouldRetry(outcome, transfer->attempt)) {
+                    Delayed retry;
+                    retry.link = {transfer->index, transfer->url};
+                    retry.attempt = transfer->attempt + 1;
+                    retry.readyAt = finishedAt + scheduler.backoff(transfer->attempt, serverDelay);
+                    logger.warn("Retrying (" + failure + ") attempt " + std::to_string(retry.attempt) + ": " +
+                                transfer->url);
+                    delayed.push_back(std::move(retry));
+                    std::push_heap(delayed.begin(), delayed.end(), laterFirst);
+                } else if (outcome != kickai::FetchScheduler::Outcome::Success) {
+                    logger.error("Error downloading image: " + failure + " " + transfer->url);
+                } else if (dedup) {
+                    finished.push(std::move(transfer));
+                } else {
+                    saved += finish(*transfer, manifest, nullptr) ? 1 : 0;
+                }
+            }
+
+            if (!active.empty() || !delayed.empty()) {
+                // The producer wakes this up when it queues new links.
+                int timeoutMs = 100;
+                if (!delayed.empty()) {
+                    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        delayed.front().readyAt - kickai::FetchScheduler::Clock::now());
+                    timeoutMs = static_cast<int>(std::max<int64_t>(0, std::min<int64_t>(timeoutMs, wait.count() + 1)));
+                }
+                curl_multi_poll(multi, nullptr, 0, timeoutMs, nullptr);
+            }
+        }
+        producer.join();
+        finished.close();
+        if (finisher.joinable()) {
+            finisher.join();
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (dedup) {
+            log(dedup->report());
         }
+        log(scheduler.report());
+        log("Saved " + std::to_string(saved.load()) + " of " + std::to_string(started) + " images in " +
+            std::to_string(seconds) + " s with " + std::to_string(idleHandles.size()) + " handles; " +
+            std::to_string(manifest.doneCount()) + " links done in total.");
     }
 
 private:
+    struct Delayed {
+        kickai::FetchScheduler::Clock::time_point readyAt;
+        ImageLink link;
+        int attempt = 0;
+    };
+
+    static bool laterFirst(const Delayed& a, const Delayed& b) { return a.readyAt > b.readyAt; }
+
+    static kickai::SchedulerOptions schedulerOptions(const DownloadOptions& options) {
+        kickai::SchedulerOptions result = options.scheduler;
+        result.maxConcurrency = std::max(1, options.concurrency);
+        return result;
+    }
+
+    // One image streamed into a temp file next to its destination, renamed
+    // into place only when the transfer succeeds; otherwise the partial file
+    // is removed. Only one curl buffer is ever held in memory.
+    struct Transfer {
+        int attempt = 0;
+        kickai::FetchScheduler::Clock::time_point started;
+        size_t index = 0;
+        std::string url;
+        std::string outputName;
+        std::string finalPath;
+        std::string tempPath;
+        int fd = -1;
+        bool failed = false;  // a write to the temp file failed
+        bool committed = false;
+        EVP_MD_CTX* sha = nullptr; // SHA-256 of the body, fed as chunks arrive
+
+        ~Transfer() {
+            EVP_MD_CTX_free(sha);
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            if (!committed && !tempPath.empty()) {
+                ::unlink(tempPath.c_str());
+            }
+        }
+
+        bool commit() {
+            int file = fd;
+            fd = -1;
+            if (::close(file) != 0 || failed) {
+                return false;
+            }
+            committed = std::rename(tempPath.c_str(), finalPath.c_str()) == 0;
+            return committed;
+        }
+    };
+
+    kickai::Logger logger{"image_downloader.log"};
     std::string query;
     std::string saveDir;
     int numImages;
-    std::vector<std::string> imageLinks;
+    DownloadOptions options;
+    kickai::FetchScheduler scheduler;
+    CURLM* multi = nullptr;
+    std::vector<CURL*> idleHandles; // finished handles keep their connection cache
 
     void createDirectory(const std::string& dir) {
         mkdir(dir.c_str(), 0777); // Create directory if it does not exist
     }
 
-    void fetchImageLinks() {
-        std::string searchUrl = "https://yandex.com/images/search?text=" + query + "&format=json";
-        std::string response = performGetRequest(searchUrl);
-        
-        try {
-            auto jsonResponse = json::parse(response);
-            for (const auto& item : jsonResponse["items"]) {
-                std::string imageUrl = item["image"]["url"];
-                imageLinks.push_back(imageUrl);
+    // Moves a completed download into place unless the dedup index already
+    // has it, in which case the temp file is dropped. Either way the link is
+    // done as far as the manifest is concerned. Returns whether it was saved.
+    bool finish(Transfer& transfer, CrawlManifest& manifest, DedupIndex* dedup) {
+        std::string sha;
+        uint64_t dhash = 0;
+        bool hasHash = false;
+        if (dedup) {
+            unsigned char digest[EVP_MAX_MD_SIZE];
+            unsigned int length = 0;
+            EVP_DigestFinal_ex(transfer.sha, digest, &length);
+            static const char kHex[] = "0123456789abcdef";
+            for (unsigned int i = 0; i < length; ++i) {
+                sha += kHex[digest[i] >> 4];
+                sha += kHex[digest[i] & 15];
+            }
+            hasHash = differenceHash(transfer.tempPath, dhash);
+
+            std::string original;
+            DedupIndex::Verdict verdict = dedup->check(sha, hasHash, dhash, original);
+            if (verdict != DedupIndex::Verdict::Unique) {
+                manifest.markDone(transfer.index);
+                log(std::string(verdict == DedupIndex::Verdict::Exact ? "Exact" : "Near") + " duplicate of " +
+                    original + " skipped: " + transfer.url);
+                return false;
             }
-            log("Fetched " + std::to_string(imageLinks.size()) + " image links.");
-        } catch (const json::parse_error& e) {
-            log("JSON parse error: " + std::string(e.what()));
-            throw std::runtime_error("Failed to fetch image links.");
         }
+        if (!transfer.commit()) {
+            logger.error("Error downloading image: could not write " + transfer.outputName);
+            return false;
+        }
+        if (dedup) {
+            dedup->add(sha, hasHash, dhash, transfer.outputName);
+        }
+        manifest.markDone(transfer.index);
+        log("Image downloaded: " + transfer.outputName);
+        return true;
     }
 
-    void downloadImage(const std::string& imageUrl, const std::string& outputName) {
+    // Queues links the manifest already knows, then reads further result
+    // pages until enough links are known or the results run out.
+    void produceLinks(kickai::BoundedQueue<ImageLink>& links, CrawlManifest& manifest, size_t limit) {
+        CURL* curl = curl_easy_init();
+        auto enqueue = [&](const ImageLink& link) {
+            bool accepted = links.push(link);
+            curl_multi_wakeup(multi);
+            return accepted;
+        };
         try {
-            std::string imageData = performGetRequest(imageUrl);
-            std::ofstream outFile(saveDir + "/" + outputName, std::ios::binary);
-            outFile.write(imageData.c_str(), imageData.size());
-            outFile.close();
-            log("Image downloaded: " + outputName);
+            if (!curl) {
+                throw std::runtime_error("Failed to create curl handle.");
+            }
+            for (const ImageLink& link : manifest.pending(limit)) {
+                if (!enqueue(link)) {
+                    break;
+                }
+            }
+            bool paged = options.searchUrl.find("{page}") != std::string::npos;
+            for (int page = manifest.nextPage(); manifest.linkCount() < limit && page < options.maxPages; ++page) {
+                if (!paged && page > 0) {
+                    break;
+                }
+                std::string url = searchUrl(curl, page);
+                std::string body;
+                if (!fetchPage(curl, url, body)) {
+                    break;
+                }
+
+                LinkCollector collector;
+                if (!json::sax_parse(body, &collector)) {
+                    logger.error("JSON parse error on page " + std::to_string(page) + " " + collector.error);
+                    break;
+                }
+                if (collector.urls.empty()) {
+                    break; // past the last page
+                }
+                size_t firstNew = manifest.linkCount();
+                for (const ImageLink& link : manifest.addPage(page, collector.urls)) {
+                    if (link.index >= limit || !enqueue(link)) {
+                        break;
+                    }
+                }
+                log("Fetched page " + std::to_string(page) + ": " + std::to_string(manifest.linkCount() - firstNew) +
+                    " image links.");
+            }
         } catch (const std::exception& e) {
-            log("Error downloading image: " + std::string(e.what()));
+            logger.error("Link discovery stopped: " + std::string(e.what()));
+        }
+        if (curl) {
+            curl_easy_cleanup(curl);
         }
+        links.close();
+        curl_multi_wakeup(multi);
     }
 
-    std::string performGetRequest(const std::string& url) {
-        CURL* curl;
-        CURLcode res;
-        std::string response;
-
-        curl = curl_easy_init();
-        if (curl) {
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    // GETs a result page through the scheduler, retrying as it allows.
+    bool fetchPage(CURL* curl, const std::string& url, std::string& body) {
+        for (int attempt = 0;; ++attempt) {
+            auto now = kickai::FetchScheduler::Clock::now();
+            kickai::FetchScheduler::Clock::time_point retryAt;
+            while (!scheduler.tryAcquire(url, now, retryAt)) {
+                std::this_thread::sleep_until(retryAt);
+                now = kickai::FetchScheduler::Clock::now();
+            }
+            body.clear();
+            configureHandle(curl, url);
             curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-            curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0");
-            res = curl_easy_perform(curl);
-            curl_easy_cleanup(curl);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+            CURLcode res = curl_easy_perform(curl);
+            long status = 0;
+            curl_off_t retryAfter = 0;
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+            curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retryAfter);
+            auto outcome = kickai::FetchScheduler::classify(res == CURLE_OK, status);
+            double serverDelay = retryAfter > 0 ? static_cast<double>(retryAfter) : -1;
+            scheduler.record(url, outcome, kickai::FetchScheduler::Clock::now() - now, serverDelay);
+            if (outcome == kickai::FetchScheduler::Outcome::Success) {
+                return true;
+            }
+            std::string failure = res != CURLE_OK ? curl_easy_strerror(res) : "HTTP " + std::to_string(status);
+            if (!scheduler.shouldRetry(outcome, attempt)) {
+                logger.error("Curl error: " + failure + " fetching " + url);
+                return false;
+            }
+            logger.warn("Retrying (" + failure + ") attempt " + std::to_string(attempt + 1) + ": " + url);
+            std::this_thread::sleep_for(scheduler.backoff(attempt, serverDelay));
+        }
+    }
+
+    std::string searchUrl(CURL* curl, int page) const {
+        std::string url = options.searchUrl;
+        char* escaped = curl_easy_escape(curl, query.c_str(), static_cast<int>(query.size()));
+        std::string encodedQuery = escaped ? escaped : query;
+        curl_free(escaped);
+        for (auto [name, value] : {std::pair<std::string, std::string>{"{query}", encodedQuery},
+                                   {"{page}", std::to_string(page)}}) {
+            for (size_t at = url.find(name); at != std::string::npos; at = url.find(name, at + value.size())) {
+                url.replace(at, name.size(), value);
+            }
+        }
+        return url;
+    }
 
-            if (res != CURLE_OK) {
-                log("Curl error: " + std::string(curl_easy_strerror(res)));
-                throw std::runtime_error("Failed to perform GET request.");
+    CURLM* multiHandle() {
+        if (!multi) {
+            multi = curl_multi_init();
+            if (!multi) {
+                throw std::runtime_error("Failed to create curl multi handle.");
             }
+            curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(std::max(1, options.concurrency)));
+            curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(std::max(1, options.perHost)));
+            curl_multi_setopt(multi, CURLMOPT_PIPELINING, options.http2 ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+        }
+        return multi;
+    }
+
+    // A reused or new easy handle set up to GET url.
+    CURL* acquireHandle(const std::string& url) {
+        CURL* curl = nullptr;
+        if (!idleHandles.empty()) {
+            curl = idleHandles.back();
+            idleHandles.pop_back();
+            curl_easy_reset(curl);
+        } else {
+            curl = curl_easy_init();
+            if (!curl) {
+                return nullptr;
+            }
+        }
+        configureHandle(curl, url);
+        return curl;
+    }
+
+    void configureHandle(CURL* curl, const std::string& url) const {
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0");
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        if (options.http2) {
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+            // Wait for an existing connection that can multiplex rather than
+            // opening a new one.
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
         }
-        return response;
     }
 
     static size_t writeCallback(void* contents, size_t size, size_t nmemb, std::string* userp) {
@@ -90,25 +879,119 @@ private:
         return size * nmemb;
     }
 
-    void log(const std::string& message) {
-        std::ofstream logFile("image_downloader.log", std::ios_base::app);
-        if (logFile) {
-            logFile << message << std::endl;
+    // Writes each chunk straight to the transfer's temp file. A short count
+    // tells curl to abort the transfer.
+    static size_t fileWriteCallback(void* contents, size_t size, size_t nmemb, Transfer* transfer) {
+        const char* data = static_cast<const char*>(contents);
+        size_t total = size * nmemb, done = 0;
+        while (done < total) {
+            ssize_t n = ::write(transfer->fd, data + done, total - done);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                transfer->failed = true;
+                return done;
+            }
+            done += static_cast<size_t>(n);
+        }
+        if (transfer->sha) {
+            EVP_DigestUpdate(transfer->sha, contents, total);
+        }
+        return total;
+    }
+
+    // Reserves disk space for the announced body so the file is laid out in
+    // one go; the file size still grows with what is actually written.
+    static size_t fileHeaderCallback(char* buffer, size_t size, size_t nitems, Transfer* transfer) {
+        size_t total = size * nitems;
+        static const char kName[] = "content-length:";
+        const size_t nameLength = sizeof(kName) - 1;
+        if (total > nameLength && strncasecmp(buffer, kName, nameLength) == 0) {
+            long long length = std::strtoll(std::string(buffer + nameLength, total - nameLength).c_str(), nullptr, 10);
+            if (length > 0) {
+                ::fallocate(transfer->fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(length));
+            }
         }
+        return total;
+    }
+
+    void log(const std::string& message) {
+        logger.info(message);
     }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
+    std::vector<std::string> positional;
+    DownloadOptions options;
     try {
-        std::string query = "nature"; // Search query
-        std::string saveDirectory = "downloaded_images";
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--no-http2") {
+                options.http2 = false;
+                continue;
+            }
+            if (arg == "--no-dedup") {
+                options.dedup = false;
+                continue;
+            }
+            if (arg.rfind("--", 0) != 0) {
+                positional.push_back(arg);
+                continue;
+            }
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + arg);
+            }
+            std::string value = argv[++i];
+            if (arg == "--concurrency") {
+                options.concurrency = std::stoi(value);
+            } else if (arg == "--per-host") {
+                options.perHost = std::stoi(value);
+            } else if (arg == "--search-url") {
+                options.searchUrl = value;
+            } else if (arg == "--host-rate") {
+                options.scheduler.hostRate = std::stod(value);
+                if (!(options.scheduler.hostRate >= 0)) {
+                    throw std::invalid_argument("--host-rate must not be negative");
+                }
+            } else if (arg == "--host-burst") {
+                options.scheduler.hostBurst = std::stod(value);
+                if (!(options.scheduler.hostBurst >= 1)) {
+                    throw std::invalid_argument("--host-burst must be at least 1");
+                }
+            } else if (arg == "--retries") {
+                options.scheduler.maxRetries = std::stoi(value);
+            } else if (arg == "--dedup-distance") {
+                options.dedupDistance = std::stoi(value);
+            } else if (arg == "--max-pages") {
+                options.maxPages = std::stoi(value);
+            } else {
+                throw std::invalid_argument("Unknown option: " + arg);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Usage: " << argv[0] << " [query] [save_dir] [num_images]"
+                  << " [--concurrency N] [--per-host N] [--no-http2] [--search-url TEMPLATE] [--max-pages N]"
+                  << " [--no-dedup] [--dedup-distance BITS] [--host-rate R] [--host-burst N] [--retries N]"
+                  << std::endl;
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
 
-        ImageDownloader downloader(query, saveDirectory);
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    int result = EXIT_SUCCESS;
+    try {
+        std::string query = positional.size() > 0 ? positional[0] : "nature"; // Search query
+        std::string saveDirectory = positional.size() > 1 ? positional[1] : "downloaded_images";
+        int numImages = positional.size() > 2 ? std::stoi(positional[2]) : 10;
+
+        ImageDownloader downloader(query, saveDirectory, numImages, options);
         downloader.downloadImages();
     } catch (const std::exception& e) {
         std::cerr << "Exception: " << e.what() << std::endl;
-        return EXIT_FAILURE;
+        result = EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    curl_global_cleanup();
+    return result;
 }